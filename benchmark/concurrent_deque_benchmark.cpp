@@ -0,0 +1,76 @@
+//throughput of concurrent_deque against a deque guarded by one mutex, with the same number
+//of producer and consumer threads.
+//build: g++ -std=c++14 -O2 -pthread -I.. concurrent_deque_benchmark.cpp
+
+#include "concurrent_deque.hpp"
+#include "deque.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    const int itemsPerProducer = 1000000;
+
+    struct locked_deque {
+        std::mutex m;
+        sjtu::deque<long long> q;
+
+        void push_back(long long v) {
+            std::lock_guard<std::mutex> lock(m);
+            q.push_back(v);
+        }
+
+        bool try_pop_front(long long &v) {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty()) return false;
+            v = q.front();
+            q.pop_front();
+            return true;
+        }
+    };
+
+    //returns the number of million operations (a push or a pop) per second
+    template<class Queue>
+    double run(Queue &q, int pairs) {
+        std::atomic<long long> sum(0);
+        std::vector<std::thread> threads;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int t = 0; t < pairs; t++) {
+            threads.emplace_back([&q, t] {
+                for (int i = 0; i < itemsPerProducer; i++) q.push_back((long long) t * itemsPerProducer + i);
+            });
+            threads.emplace_back([&q, &sum] {
+                long long v, s = 0;
+                for (int got = 0; got < itemsPerProducer;)
+                    if (q.try_pop_front(v)) {
+                        s += v;
+                        got++;
+                    }
+                sum += s;
+            });
+        }
+        for (int i = 0; i < (int) threads.size(); i++) threads[i].join();
+        auto t1 = std::chrono::steady_clock::now();
+        long long n = (long long) pairs * itemsPerProducer;
+        if (sum.load() != n * (n - 1) / 2) std::printf("wrong sum\n");
+        double sec = std::chrono::duration<double>(t1 - t0).count();
+        return 2.0 * n / sec / 1e6;
+    }
+}
+
+int main() {
+    int hw = (int) std::thread::hardware_concurrency();
+    std::printf("%8s %18s %18s\n", "threads", "concurrent_deque", "mutex + deque");
+    for (int pairs = 1; pairs * 2 <= (hw < 2 ? 2 : hw); pairs *= 2) {
+        sjtu::concurrent_deque<long long> a;
+        locked_deque b;
+        double x = run(a, pairs);
+        double y = run(b, pairs);
+        std::printf("%8d %13.2f Mop/s %13.2f Mop/s\n", pairs * 2, x, y);
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+//the hot paths of sjtu::deque against std::deque and std::vector, for elements of 4, 64 and
+//256 bytes and containers of 2^10 to 2^18 elements. the operations that std::vector does not
+//have (at the front) are only run for the deques.
+//build with CMake (needs Google Benchmark), and run the target run_benchmarks to get the
+//results in JSON, or pass --benchmark_out=<file> --benchmark_out_format=json to deque_benchmark.
+
+#include "deque.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace {
+    //an element of Bytes bytes, compared by its key
+    template<int Bytes>
+    struct record {
+        int key;
+        char pad[Bytes - sizeof(int)];
+
+        record() : key(0) {}
+
+        explicit record(int k) : key(k) {}
+    };
+
+    template<class T>
+    T make(int k) { return T(k); }
+
+    inline int key(int x) { return x; }
+
+    template<int Bytes>
+    int key(const record<Bytes> &x) { return x.key; }
+
+    typedef record<64> medium;
+    typedef record<256> large;
+
+    typedef sjtu::deque<int> sjtu_int;
+    typedef std::deque<int> std_deque_int;
+    typedef std::vector<int> vector_int;
+    typedef sjtu::deque<medium> sjtu_64;
+    typedef std::deque<medium> std_deque_64;
+    typedef std::vector<medium> vector_64;
+    typedef sjtu::deque<large> sjtu_256;
+    typedef std::deque<large> std_deque_256;
+    typedef std::vector<large> vector_256;
+
+    void sizes(benchmark::internal::Benchmark *b) {
+        for (int n = 1 << 10; n <= 1 << 18; n <<= 4) b->Arg(n);
+    }
+
+    template<class C>
+    C filled(int n) {
+        C c;
+        for (int i = 0; i < n; i++) c.push_back(make<typename C::value_type>(i));
+        return c;
+    }
+
+    template<class C>
+    void PushBack(benchmark::State &state) {
+        int n = state.range(0);
+        for (auto _ : state) {
+            C c;
+            for (int i = 0; i < n; i++) c.push_back(make<typename C::value_type>(i));
+            benchmark::DoNotOptimize(c);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template<class C>
+    void PushFront(benchmark::State &state) {
+        int n = state.range(0);
+        for (auto _ : state) {
+            C c;
+            for (int i = 0; i < n; i++) c.push_front(make<typename C::value_type>(i));
+            benchmark::DoNotOptimize(c);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template<class C>
+    void PopBack(benchmark::State &state) {
+        int n = state.range(0);
+        for (auto _ : state) {
+            state.PauseTiming();
+            C c = filled<C>(n);
+            state.ResumeTiming();
+            for (int i = 0; i < n; i++) c.pop_back();
+            benchmark::DoNotOptimize(c);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template<class C>
+    void PopFront(benchmark::State &state) {
+        int n = state.range(0);
+        for (auto _ : state) {
+            state.PauseTiming();
+            C c = filled<C>(n);
+            state.ResumeTiming();
+            for (int i = 0; i < n; i++) c.pop_front();
+            benchmark::DoNotOptimize(c);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    //operator[] at n random ranks
+    template<class C>
+    void RandomAccess(benchmark::State &state) {
+        int n = state.range(0);
+        const C c = filled<C>(n);
+        std::vector<int> ranks(n);
+        std::mt19937 gen(158);
+        for (int i = 0; i < n; i++) ranks[i] = gen() % n;
+        for (auto _ : state) {
+            long long sum = 0;
+            for (int i = 0; i < n; i++) sum += key(c[ranks[i]]);
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template<class C>
+    void Iterate(benchmark::State &state) {
+        int n = state.range(0);
+        const C c = filled<C>(n);
+        for (auto _ : state) {
+            long long sum = 0;
+            for (typename C::const_iterator it = c.begin(); it != c.end(); ++it) sum += key(*it);
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    //an insert and an erase in the middle, so that the size stays n
+    template<class C>
+    void MiddleInsertErase(benchmark::State &state) {
+        int n = state.range(0);
+        C c = filled<C>(n);
+        for (auto _ : state) {
+            c.insert(c.begin() + n / 2, make<typename C::value_type>(-1));
+            c.erase(c.begin() + n / 3);
+        }
+        benchmark::DoNotOptimize(c);
+        state.SetItemsProcessed(state.iterations() * 2);
+    }
+
+    template<class C>
+    void Copy(benchmark::State &state) {
+        int n = state.range(0);
+        const C c = filled<C>(n);
+        for (auto _ : state) {
+            C d(c);
+            benchmark::DoNotOptimize(d);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template<class C>
+    void Clear(benchmark::State &state) {
+        int n = state.range(0);
+        for (auto _ : state) {
+            state.PauseTiming();
+            C c = filled<C>(n);
+            state.ResumeTiming();
+            c.clear();
+            benchmark::DoNotOptimize(c);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+}
+
+//every operation for the three containers, then the ones at the front for the deques
+#define DEQUE_BENCHMARKS(type) \
+    BENCHMARK_TEMPLATE(PushBack, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(PopBack, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(RandomAccess, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(Iterate, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(MiddleInsertErase, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(Copy, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(Clear, type)->Apply(sizes);
+
+#define FRONT_BENCHMARKS(type) \
+    BENCHMARK_TEMPLATE(PushFront, type)->Apply(sizes); \
+    BENCHMARK_TEMPLATE(PopFront, type)->Apply(sizes);
+
+DEQUE_BENCHMARKS(sjtu_int)
+DEQUE_BENCHMARKS(std_deque_int)
+DEQUE_BENCHMARKS(vector_int)
+DEQUE_BENCHMARKS(sjtu_64)
+DEQUE_BENCHMARKS(std_deque_64)
+DEQUE_BENCHMARKS(vector_64)
+DEQUE_BENCHMARKS(sjtu_256)
+DEQUE_BENCHMARKS(std_deque_256)
+DEQUE_BENCHMARKS(vector_256)
+
+FRONT_BENCHMARKS(sjtu_int)
+FRONT_BENCHMARKS(std_deque_int)
+FRONT_BENCHMARKS(sjtu_64)
+FRONT_BENCHMARKS(std_deque_64)
+FRONT_BENCHMARKS(sjtu_256)
+FRONT_BENCHMARKS(std_deque_256)
+
+BENCHMARK_MAIN();
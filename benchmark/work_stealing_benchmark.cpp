@@ -0,0 +1,105 @@
+//a small task scheduler with one deque per worker: a worker runs the tasks at the back of its
+//own deque and steals from the front of the others when it has none. work_stealing_deque is
+//compared with a deque guarded by a mutex.
+//build: g++ -std=c++14 -O2 -pthread -I.. work_stealing_benchmark.cpp
+
+#include "work_stealing_deque.hpp"
+#include "deque.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    //a task of depth d spawns two tasks of depth d - 1, so there are 2^(depth + 1) - 1 tasks
+    const int depth = 22;
+    const long long totalTasks = (2LL << depth) - 1;
+
+    struct locked_deque {
+        std::mutex m;
+        sjtu::deque<int> q;
+
+        void push_back(int v) {
+            std::lock_guard<std::mutex> lock(m);
+            q.push_back(v);
+        }
+
+        bool pop_back(int &v) {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty()) return false;
+            v = q.back();
+            q.pop_back();
+            return true;
+        }
+
+        bool steal(int &v) {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty()) return false;
+            v = q.front();
+            q.pop_front();
+            return true;
+        }
+    };
+
+    //returns the number of million tasks per second
+    template<class Queue>
+    double run(int workers) {
+        std::vector<Queue *> queues;
+        for (int i = 0; i < workers; i++) queues.push_back(new Queue);
+        std::atomic<long long> done(0);
+        queues[0]->push_back(depth);
+        std::vector<std::thread> threads;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int w = 0; w < workers; w++) {
+            threads.emplace_back([&queues, &done, w, workers] {
+                Queue &own = *queues[w];
+                unsigned seed = w * 2654435761u + 1;
+                long long local = 0;
+                int task;
+                while (done.load(std::memory_order_relaxed) < totalTasks) {
+                    bool got = own.pop_back(task);
+                    if (!got && workers > 1) {
+                        seed = seed * 1103515245 + 12345;
+                        int victim = (int) ((seed >> 8) % workers);
+                        if (victim != w) got = queues[victim]->steal(task);
+                    }
+                    if (!got) {
+                        if (local != 0) {
+                            done += local;
+                            local = 0;
+                        }
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    if (task > 0) {
+                        own.push_back(task - 1);
+                        own.push_back(task - 1);
+                    }
+                    if (++local == 1024) {
+                        done += local;
+                        local = 0;
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < workers; i++) threads[i].join();
+        auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < workers; i++) delete queues[i];
+        if (done.load() != totalTasks) std::printf("wrong task count\n");
+        return totalTasks / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+    }
+}
+
+int main() {
+    int hw = (int) std::thread::hardware_concurrency();
+    std::printf("%8s %20s %18s\n", "workers", "work_stealing_deque", "mutex + deque");
+    for (int workers = 1; workers <= (hw < 1 ? 1 : hw); workers *= 2) {
+        double x = run<sjtu::work_stealing_deque<int> >(workers);
+        double y = run<locked_deque>(workers);
+        std::printf("%8d %15.2f Mt/s %13.2f Mt/s\n", workers, x, y);
+    }
+    return 0;
+}
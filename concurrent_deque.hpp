@@ -0,0 +1,160 @@
+#ifndef SJTU_CONCURRENT_DEQUE_HPP
+#define SJTU_CONCURRENT_DEQUE_HPP
+
+#include "deque.hpp"
+#include "hazard_pointers.hpp"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace sjtu {
+
+    //a lock-free multi-producer multi-consumer FIFO queue made of node blocks like deque.
+    //producers claim the slots of the tail block and consumers the slots of the head block
+    //with a fetch-and-add on the counters of the block, a new block is linked when the tail
+    //one is used up, and the used up head blocks are freed through hazard pointers.
+    //every slot has a state, a consumer that comes to a slot before its producer marks it as
+    //taken and both of them move on to another slot.
+    //at most maxThreads threads can be inside the operations at the same time, the others wait.
+    template<class T, int BlockLength = default_block_length<T, inline_storage>::value>
+    class concurrent_deque {
+    public:
+        typedef typename inline_storage::template block<T> block_type;
+        typedef typename block_type::slot slot;
+
+        static const int nodeLength = BlockLength;
+        static_assert(BlockLength >= 1, "a node must hold at least one element");
+
+    private:
+        enum {
+            EMPTY, READY, TAKEN
+        };
+
+        struct cell {
+            std::atomic<int> state;
+            slot data;
+        };
+
+        struct node {
+            std::atomic<int> deqIndex;  //the next slot for a consumer
+            char pad1[64];
+            std::atomic<int> enqIndex;  //the next slot for a producer
+            char pad2[64];
+            std::atomic<node *> next;
+            cell cells[nodeLength];
+
+            node() : deqIndex(0), enqIndex(0), next(NULL) {
+                for (int i = 0; i < nodeLength; i++) cells[i].state.store(EMPTY, std::memory_order_relaxed);
+            }
+        };
+
+        std::allocator<T> alloc;    //only used to construct the elements in the slots
+        char pad0[64];
+        std::atomic<node *> head;
+        char pad1[64];
+        std::atomic<node *> tail;
+        char pad2[64];
+        hazard_pointers<node> hp;
+
+    public:
+        explicit concurrent_deque(int maxThreads = 128) : hp(maxThreads) {
+            node *p = new node;
+            head.store(p);
+            tail.store(p);
+        }
+
+        concurrent_deque(const concurrent_deque &) = delete;
+
+        concurrent_deque &operator=(const concurrent_deque &) = delete;
+
+        //no thread may be using the queue any more
+        ~concurrent_deque() {
+            node *p = head.load();
+            while (p != NULL) {
+                node *n = p->next.load();
+                for (int i = 0; i < nodeLength; i++)
+                    if (p->cells[i].state.load() == READY) block_type::destroy(alloc, &p->cells[i].data);
+                delete p;
+                p = n;
+            }
+        }
+
+        void push_back(const T &value) { emplace_back(value); }
+
+        void push_back(T &&value) { emplace_back(std::move(value)); }
+
+        //constructs an element with args at the end
+        template<class... Args>
+        void emplace_back(Args &&... args) {
+            //the element is built once and moved into the claimed slot, or back if the slot
+            //has been given up by its consumer
+            slot tmp;
+            block_type::construct(alloc, &tmp, std::forward<Args>(args)...);
+            typename hazard_pointers<node>::guard g(hp);
+            while (true) {
+                node *last = g.protect(0, tail);
+                int idx = last->enqIndex.fetch_add(1);
+                if (idx >= nodeLength) {
+                    //the block is used up, link a new one or help the thread which did it
+                    if (last != tail.load()) continue;
+                    node *next = last->next.load();
+                    if (next == NULL) {
+                        node *p = new node;
+                        if (last->next.compare_exchange_strong(next, p)) {
+                            tail.compare_exchange_strong(last, p);
+                            continue;
+                        }
+                        delete p;
+                    } else tail.compare_exchange_strong(last, next);
+                    continue;
+                }
+                cell &c = last->cells[idx];
+                block_type::relocate(alloc, &c.data, &tmp);
+                int expected = EMPTY;
+                if (c.state.compare_exchange_strong(expected, READY, std::memory_order_release)) return;
+                block_type::relocate(alloc, &tmp, &c.data);
+            }
+        }
+
+        //removes the first element and moves it to value.
+        //returns false if the queue is empty.
+        bool try_pop_front(T &value) {
+            typename hazard_pointers<node>::guard g(hp);
+            while (true) {
+                node *first = g.protect(0, head);
+                if (first->deqIndex.load() >= first->enqIndex.load() && first->next.load() == NULL)
+                    return false;
+                int idx = first->deqIndex.fetch_add(1);
+                if (idx >= nodeLength) {
+                    //every slot of the block has been claimed, move on to the next one
+                    node *next = first->next.load();
+                    if (next == NULL) return false;
+                    //the tail must not be left on a block that is going to be freed
+                    node *last = first;
+                    if (tail.load() == first) tail.compare_exchange_strong(last, next);
+                    if (head.compare_exchange_strong(first, next)) {
+                        g.clear(0);
+                        g.retire(first);
+                    }
+                    continue;
+                }
+                cell &c = first->cells[idx];
+                if (c.state.exchange(TAKEN, std::memory_order_acq_rel) == READY) {
+                    value = std::move(*block_type::get(&c.data));
+                    block_type::destroy(alloc, &c.data);
+                    return true;
+                }
+            }
+        }
+
+        //whether the queue is empty, only a hint while other threads are using it
+        bool empty() {
+            typename hazard_pointers<node>::guard g(hp);
+            node *first = g.protect(0, head);
+            return first->deqIndex.load() >= first->enqIndex.load() && first->next.load() == NULL;
+        }
+    };
+}
+
+#endif
@@ -3,82 +3,765 @@
 
 #include "exceptions.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//define SJTU_DEQUE_UNCHECKED before including this file to drop the validity checks of the
+//iterators on dereference and increment, for the hot loops of code that is known to be correct.
+#ifdef SJTU_DEQUE_UNCHECKED
+#define SJTU_DEQUE_CHECK(cond) ((void) 0)
+#else
+#define SJTU_DEQUE_CHECK(cond) do { if (!(cond)) throw invalid_iterator(); } while (0)
+#endif
 
 namespace sjtu {
 
+    //layout of the elements inside a node block.
+    //inline_storage constructs the elements in the block itself, so there is no
+    //allocation per element and no pointer hop on access (default).
+    struct inline_storage {
+        static const bool contiguous = true;   //the elements of a block are next to each other
+
+        template<class T>
+        struct block {
+            typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+            typedef T span_type;    //the segments are arrays of the elements
+            typedef const T const_span_type;
+
+            static T *get(slot *s) { return reinterpret_cast<T *>(s); }
+
+            static span_type *span(slot *s) { return get(s); }
+
+            template<class Alloc, class... Args>
+            static void construct(Alloc &a, slot *s, Args &&... args) {
+                std::allocator_traits<Alloc>::construct(a, get(s), std::forward<Args>(args)...);
+            }
+
+            template<class Alloc>
+            static void destroy(Alloc &a, slot *s) {
+                std::allocator_traits<Alloc>::destroy(a, get(s));
+            }
+
+            //move the element in src to the empty slot dst, src becomes empty
+            template<class Alloc>
+            static void relocate(Alloc &a, slot *dst, slot *src) {
+                std::allocator_traits<Alloc>::construct(a, get(dst), std::move(*get(src)));
+                destroy(a, src);
+            }
+        };
+    };
+
+    //boxed_storage keeps one heap allocated element per slot (the old layout),
+    //for the types whose address must not change while they are in the deque.
+    struct boxed_storage {
+        static const bool contiguous = false;
+
+        template<class T>
+        struct block {
+            typedef T *slot;
+            typedef T *const span_type;    //the segments are arrays of pointers to the elements
+            typedef const T *const const_span_type;
+
+            static T *get(slot *s) { return *s; }
+
+            static span_type *span(slot *s) { return s; }
+
+            template<class Alloc, class... Args>
+            static void construct(Alloc &a, slot *s, Args &&... args) {
+                T *p = std::allocator_traits<Alloc>::allocate(a, 1);
+                try {
+                    std::allocator_traits<Alloc>::construct(a, p, std::forward<Args>(args)...);
+                } catch (...) {
+                    std::allocator_traits<Alloc>::deallocate(a, p, 1);
+                    throw;
+                }
+                *s = p;
+            }
+
+            template<class Alloc>
+            static void destroy(Alloc &a, slot *s) {
+                std::allocator_traits<Alloc>::destroy(a, *s);
+                std::allocator_traits<Alloc>::deallocate(a, *s, 1);
+                *s = NULL;
+            }
+
+            template<class Alloc>
+            static void relocate(Alloc &, slot *dst, slot *src) {
+                *dst = *src;
+                *src = NULL;
+            }
+        };
+    };
+
+    //the default number of elements in a node, so that a block is about 4 KiB
+    template<class T, class Storage>
+    struct default_block_length {
+        static const int bytes = sizeof(typename Storage::template block<T>::slot);
+        static const int value = 4096 / bytes < 16 ? 16 : 4096 / bytes;
+    };
+
+    //when the nodes are split and merged, for a node of length elements.
+    //a full node is split at split_at(), and a node is merged with its neighbours while it
+    //has less than merge_below() elements and the two nodes have at most merge_max() together.
+    //the halves of a split node are far from merge_below() and a merged node is far from full,
+    //so a few inserts and erases at the same place do not split and merge a node again and again.
+    //before a full node is split, it lends elements to a neighbour with at least lend_min() free
+    //slots, and an inner node below merge_below() which can not be merged borrows from its bigger
+    //neighbour. lend_min() == 0 (or no lend_min()) turns this off.
+    struct default_block_policy {
+        static constexpr int split_at(int length) { return length / 2; }
+
+        static constexpr int merge_below(int length) { return length / 3; }
+
+        static constexpr int merge_max(int length) { return length * 2 / 3; }
+
+        static constexpr int lend_min(int length) { return length / 8 < 2 ? 2 : length / 8; }
+    };
+
+    //Policy::lend_min(length), 0 if it is not defined
+    template<class Policy, class = void>
+    struct policy_lend_min {
+        static constexpr int get(int) { return 0; }
+    };
+
+    template<class Policy>
+    struct policy_lend_min<Policy, decltype((void) Policy::lend_min(2), void())> {
+        static constexpr int get(int length) { return Policy::lend_min(length); }
+    };
+
+    //the blocks are shared between the copies of a deque and reference counted, a block is only
+    //copied when a deque holding it is going to change it (or hands out a non-const reference).
+    //copying a deque then costs O(number of nodes), and the copy can be read by another thread
+    //while the original is changed.
+    struct copy_on_write_policy : default_block_policy {
+        static const bool copy_on_write = true;
+    };
+
+    //Policy::copy_on_write, false if it is not defined
+    template<class Policy, class = void>
+    struct policy_copy_on_write : std::false_type {
+    };
+
+    template<class Policy>
+    struct policy_copy_on_write<Policy, decltype((void) Policy::copy_on_write, void())>
+            : std::integral_constant<bool, Policy::copy_on_write> {
+    };
+
+    //the counters of deque::stats() are kept, with any other policy they are not and cost
+    //nothing. to combine it with copy_on_write_policy, define both members in one policy.
+    struct statistics_policy : default_block_policy {
+        static const bool statistics = true;
+    };
+
+    //Policy::statistics, false if it is not defined
+    template<class Policy, class = void>
+    struct policy_statistics : std::false_type {
+    };
+
+    template<class Policy>
+    struct policy_statistics<Policy, decltype((void) Policy::statistics, void())>
+            : std::integral_constant<bool, Policy::statistics> {
+    };
+
+    //the report of deque::stats(). the counters are only kept with a statistics policy,
+    //the fill of the nodes is measured by stats() itself.
+    struct deque_stats {
+        static const int buckets = 16;
+
+        long long splits;   //nodes split in two
+        long long merges;   //nodes merged into a neighbour by erase
+        long long redistributions;  //elements lent to or borrowed from a neighbour (one per move)
+        long long node_allocs;  //nodes taken from the allocator
+        long long node_frees;   //nodes given back to the allocator
+        long long pool_reuses;  //nodes taken from the pool instead of the allocator
+        long long searches; //lookups of an element by rank
+        long long search_steps; //steps of the index descent of the lookups
+        long long index_steps;  //nodes walked to lay the node index out again
+        long long iterator_steps;   //nodes walked by iterator arithmetic, a longer jump is a lookup
+        long long access_histogram[buckets];    //the lookups by rank * buckets / size
+        int nodes;
+        int max_fill;   //the most elements in a node
+        double average_fill;    //the mean number of elements in a node
+        long long fill_histogram[buckets];  //the nodes by size * buckets / (block length + 1)
+    };
+
+    //the events counted by deque_counters, one for each counter of deque_stats
+    enum deque_event {
+        event_splits, event_merges, event_redistributions, event_node_allocs, event_node_frees,
+        event_pool_reuses, event_searches, event_search_steps, event_index_steps, event_iterator_steps,
+        deque_events
+    };
+
+    //the counters of a deque, nothing is kept unless Enabled
+    template<bool Enabled>
+    struct deque_counters {
+        void add(deque_event, long long) {}
+
+        void access(long long, long long) {}
+
+        void get(deque_stats &) const {}
+
+        void reset() {}
+    };
+
+    //the counters are atomic, as lookups and iterators of a const deque count too and may run
+    //on several threads. the increments are relaxed, they order nothing else.
+    template<>
+    struct deque_counters<true> {
+        std::atomic<long long> counts[deque_events];
+        std::atomic<long long> accesses[deque_stats::buckets];
+
+        deque_counters() { reset(); }
+
+        //the field of deque_stats of the event e
+        static long long deque_stats::*field(int e) {
+            static long long deque_stats::*const fields[deque_events] = {
+                &deque_stats::splits, &deque_stats::merges, &deque_stats::redistributions,
+                &deque_stats::node_allocs, &deque_stats::node_frees, &deque_stats::pool_reuses,
+                &deque_stats::searches, &deque_stats::search_steps, &deque_stats::index_steps,
+                &deque_stats::iterator_steps
+            };
+            return fields[e];
+        }
+
+        void add(deque_event e, long long n) { counts[e].fetch_add(n, std::memory_order_relaxed); }
+
+        void access(long long rank, long long size) {
+            accesses[rank * deque_stats::buckets / size].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void get(deque_stats &res) const {
+            for (int i = 0; i < deque_events; i++) res.*field(i) = counts[i].load(std::memory_order_relaxed);
+            for (int i = 0; i < deque_stats::buckets; i++)
+                res.access_histogram[i] = accesses[i].load(std::memory_order_relaxed);
+        }
+
+        void reset() {
+            for (int i = 0; i < deque_events; i++) counts[i].store(0, std::memory_order_relaxed);
+            for (int i = 0; i < deque_stats::buckets; i++) accesses[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    //the file format of deque::save(), for trivially copyable elements.
+    //a header of headerBytes bytes is followed by one record per node, and every record has
+    //recordBytes() bytes, so that the record i starts at headerBytes + i * recordBytes().
+    //a record holds the number of elements of its node in its first 8 bytes, then the elements
+    //in order from the byte blockOffset, the rest is padding. the records are aligned to 64 bytes,
+    //so the elements of a mapped file can be read in place (see mapped_deque.hpp).
+    struct deque_file {
+        static const int headerBytes = 64;
+        static const int blockOffset = 64;
+
+        struct header {
+            char magic[8];
+            std::uint32_t elementSize;  //sizeof(T) of the writer
+            std::uint32_t blockLength;  //the max number of elements in a record
+            std::uint64_t size;     //the number of elements
+            std::uint64_t records;
+        };
+
+        static const char *magic() { return "SJTUDEQ1"; }
+
+        static std::uint64_t recordBytes(std::uint64_t elementSize, std::uint64_t blockLength) {
+            return blockOffset + (elementSize * blockLength + 63) / 64 * 64;
+        }
+
+        //fill h from the first headerBytes bytes of a file, false if it is not a deque file
+        static bool readHeader(const char *bytes, header &h) {
+            std::memcpy(&h, bytes, sizeof(header));
+            return std::memcmp(h.magic, magic(), 8) == 0 && h.elementSize > 0 && h.blockLength > 0;
+        }
+
+        static void writeHeader(char *bytes, const header &h) {
+            std::memset(bytes, 0, headerBytes);
+            std::memcpy(bytes, &h, sizeof(header));
+        }
+    };
+
 
-    template<class T>
+    //Allocator is used for the elements (through std::allocator_traits), and is rebound
+    //for the nodes and their blocks. it must use plain pointers.
+    //BlockLength is the number of elements in a node, BlockPolicy decides when the nodes
+    //are split and merged (see default_block_policy).
+    template<class T, class Storage = inline_storage, class Allocator = std::allocator<T>,
+            int BlockLength = default_block_length<T, Storage>::value,
+            class BlockPolicy = default_block_policy>
     class deque {
     public:
-        const int nodeLength = 256;  //set the max size of each node
+        typedef typename Storage::template block<T> block_type;
+        typedef typename block_type::slot slot;
+        typedef Allocator allocator_type;
+        typedef std::allocator_traits<Allocator> alloc_traits;
+        typedef BlockPolicy block_policy;
+        typedef T value_type;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T &reference;
+        typedef const T &const_reference;
+        typedef T *pointer;
+        typedef const T *const_pointer;
+
+        static const int nodeLength = BlockLength;  //set the max size of each node
+        static const int splitPoint = BlockPolicy::split_at(BlockLength);
+        static const int mergeBelow = BlockPolicy::merge_below(BlockLength);
+        static const int mergeMax = BlockPolicy::merge_max(BlockLength);
+        static const int lendMin = policy_lend_min<BlockPolicy>::get(BlockLength);
+        static const bool copyOnWrite = policy_copy_on_write<BlockPolicy>::value;
+        static const bool statistics = policy_statistics<BlockPolicy>::value;
+        static_assert(BlockLength >= 2, "a node must hold at least two elements");
+        static_assert(splitPoint > 0 && splitPoint < BlockLength, "split_at() must be in (0, length)");
+        static_assert(mergeMax <= BlockLength, "merge_max() must be at most length");
+        static_assert(lendMin == 0 || lendMin >= 2, "lend_min() must be 0 or at least 2");
+
         int length; //store the number of elements in dequeue
+        int relocations;    //the elements moved by the last insert or erase, see relocated()
+        int compactRank;    //where the next compact() goes on
+
+        //the number of nodes sharing a block, only with copyOnWrite
+        struct refcount {
+            std::atomic<int> count;
+        };
 
         //data module
         struct node {
             node *prev, *next;  //pointers, pointing to the previous and next node
-            T **data;   //class T pointer array
+            slot *data;   //storage block of the elements, see block_type
+            refcount *refs; //the reference count of data, NULL without copyOnWrite
+            int start;  //the slot of the first element, the block is used as a ring buffer
             int nodeSize;   //the number of elements in this node
-            //construction
-            node(int s, node *p = NULL, node *n = NULL) {
-                //initialize
-                data = new T *[s];
-                nodeSize = 0;
-                prev = p;
-                next = n;
-            }
-
-            //destruction
-            ~node() {
-                if (this != NULL) {
-                    if (data) {
-                        for (int i = 0; i < nodeSize; i++)
-                            if (data[i]) {
-                                delete data[i];
-                                data[i] = NULL;
-                            }
-                    }
-                    if (data) delete[]data;
-                    data = NULL;
-                    prev = next = NULL;
-                    nodeSize = 0;
+            int index;  //the slot of the node in the node index, -1 if it has none
+
+            //the slot of the element at the position i of this node
+            slot *place(int i) const {
+                int k = start + i;
+                if (k >= nodeLength) k -= nodeLength;
+                return data + k;
+            }
+
+            //the element at the position i of this node
+            T *at(int i) const { return block_type::get(place(i)); }
+
+            //insert value before the position pos, the node must not be full.
+            //only the shorter side of pos is moved, returns the number of moved elements.
+            int insert(Allocator &a, int pos, T &&value) {
+                int moved;
+                if (pos < nodeSize - pos) {
+                    start = (start == 0 ? nodeLength : start) - 1;
+                    for (int i = 0; i < pos; i++)
+                        block_type::relocate(a, place(i), place(i + 1));
+                    moved = pos;
+                } else {
+                    for (int i = nodeSize; i > pos; i--)
+                        block_type::relocate(a, place(i), place(i - 1));
+                    moved = nodeSize - pos;
+                }
+                block_type::construct(a, place(pos), std::move(value));
+                nodeSize++;
+                return moved;
+            }
+
+            //remove the element at the position pos, only the shorter side of pos is moved.
+            //returns the number of moved elements.
+            int erase(Allocator &a, int pos) {
+                int moved;
+                block_type::destroy(a, place(pos));
+                if (pos < nodeSize - 1 - pos) {
+                    for (int i = pos; i > 0; i--)
+                        block_type::relocate(a, place(i), place(i - 1));
+                    start = (start + 1 == nodeLength ? 0 : start + 1);
+                    moved = pos;
+                } else {
+                    for (int i = pos; i < nodeSize - 1; i++)
+                        block_type::relocate(a, place(i), place(i + 1));
+                    moved = nodeSize - 1 - pos;
+                }
+                nodeSize--;
+                return moved;
+            }
+
+            //remove the elements in [from, to), only the shorter remaining side is moved.
+            //returns the number of moved elements.
+            int erase(Allocator &a, int from, int to) {
+                int d = to - from, moved;
+                for (int i = from; i < to; i++)
+                    block_type::destroy(a, place(i));
+                if (from < nodeSize - to) {
+                    for (int i = from - 1; i >= 0; i--)
+                        block_type::relocate(a, place(i + d), place(i));
+                    start = (start + d) % nodeLength;
+                    moved = from;
+                } else {
+                    for (int i = to; i < nodeSize; i++)
+                        block_type::relocate(a, place(i - d), place(i));
+                    moved = nodeSize - to;
                 }
+                nodeSize -= d;
+                return moved;
             }
         };
 
+        typedef typename alloc_traits::template rebind_alloc<node> node_allocator;
+        typedef typename alloc_traits::template rebind_alloc<slot> slot_allocator;
+        typedef typename alloc_traits::template rebind_alloc<refcount> refcount_allocator;
+        typedef std::allocator_traits<node_allocator> node_traits;
+        typedef std::allocator_traits<slot_allocator> slot_traits;
+        typedef std::allocator_traits<refcount_allocator> refcount_traits;
+
+        Allocator alloc;
+        mutable deque_counters<statistics> counters;  //see stats(), empty without statistics
         node *head, *tail;  //pointers, pointing to the head-node and tail-node
 
-        //clear all of the nodes
-        void clearAll() {
-            if (head == NULL) return;
+        //node pool, the freed nodes are kept in a list linked by next and reused before
+        //anything is allocated, up to poolLimit of them. reserve_back() and reserve_front()
+        //may fill it over poolLimit, reservedBack and reservedFront of its nodes are kept for
+        //the ends until they are used.
+        node *pool;
+        int poolSize, poolLimit;
+        int reservedBack, reservedFront;
+
+        //a node with a block from the allocator, its other members are not set
+        node *allocNode() {
+            counters.add(event_node_allocs, 1);
+            slot_allocator sa(alloc);
+            node_allocator na(alloc);
+            slot *data = slot_traits::allocate(sa, nodeLength);
+            refcount *refs = NULL;
+            node *res;
+            try {
+                if (copyOnWrite) refs = newRefcount();
+                res = node_traits::allocate(na, 1);
+            } catch (...) {
+                slot_traits::deallocate(sa, data, nodeLength);
+                if (refs != NULL) freeRefcount(refs);
+                throw;
+            }
+            res->data = data;
+            res->refs = refs;
+            return res;
+        }
+
+        //get an empty node from the pool, or allocate a new one
+        node *newNode(node *p, node *n) {
+            node *res;
+            if (pool != NULL) {
+                res = pool;
+                pool = pool->next;
+                poolSize--;
+                counters.add(event_pool_reuses, 1);
+            } else res = allocNode();
+            res->prev = p;
+            res->next = n;
+            res->start = 0;
+            res->nodeSize = 0;
+            res->index = -1;
+            return res;
+        }
+
+        //destroy the elements of p, and put p in the pool if the pool is not full.
+        //if the block of p is shared, only the reference is dropped.
+        void deleteNode(node *p) {
+            if (shared(p) && p->refs->count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                node_allocator na(alloc);
+                node_traits::deallocate(na, p, 1);
+                return;
+            }
+            if (copyOnWrite) p->refs->count.store(1, std::memory_order_relaxed);
+            for (int i = 0; i < p->nodeSize; i++)
+                block_type::destroy(alloc, p->place(i));
+            p->nodeSize = 0;
+            if (poolSize < poolLimit) {
+                p->next = pool;
+                pool = p;
+                poolSize++;
+            } else freeNode(p);
+        }
+
+        //give an empty node back to the allocator
+        void freeNode(node *p) {
+            counters.add(event_node_frees, 1);
+            slot_allocator sa(alloc);
+            node_allocator na(alloc);
+            slot_traits::deallocate(sa, p->data, nodeLength);
+            if (p->refs != NULL) freeRefcount(p->refs);
+            node_traits::deallocate(na, p, 1);
+        }
+
+        refcount *newRefcount() {
+            refcount_allocator ra(alloc);
+            refcount *r = refcount_traits::allocate(ra, 1);
+            ::new(static_cast<void *>(r)) refcount();
+            r->count.store(1, std::memory_order_relaxed);
+            return r;
+        }
+
+        void freeRefcount(refcount *r) {
+            refcount_allocator ra(alloc);
+            r->~refcount();
+            refcount_traits::deallocate(ra, r, 1);
+        }
+
+        //whether the block of p is shared with another deque
+        static bool shared(const node *p) {
+            return copyOnWrite && p->refs->count.load(std::memory_order_acquire) != 1;
+        }
+
+        //give p a block of its own before it is changed, by copying the elements
+        void unshare(node *p) {
+            if (shared(p)) copyBlock(p, std::integral_constant<bool, copyOnWrite>());
+        }
+
+        //without copyOnWrite no block is shared, and the elements need not be copyable
+        void copyBlock(node *, std::false_type) {}
+
+        void copyBlock(node *p, std::true_type) {
+            slot_allocator sa(alloc);
+            slot *data = slot_traits::allocate(sa, nodeLength);
+            refcount *refs;
+            int i = 0;
+            try {
+                refs = newRefcount();
+                try {
+                    for (; i < p->nodeSize; i++)
+                        block_type::construct(alloc, data + (p->place(i) - p->data), *(p->at(i)));
+                } catch (...) {
+                    freeRefcount(refs);
+                    throw;
+                }
+            } catch (...) {
+                while (i-- > 0) block_type::destroy(alloc, data + (p->place(i) - p->data));
+                slot_traits::deallocate(sa, data, nodeLength);
+                throw;
+            }
+            if (p->refs->count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                //the other owners have gone in the meantime
+                for (int j = 0; j < p->nodeSize; j++) block_type::destroy(alloc, p->place(j));
+                slot_traits::deallocate(sa, p->data, nodeLength);
+                freeRefcount(p->refs);
+            }
+            p->data = data;
+            p->refs = refs;
+        }
+
+        //allocate nodes for the pool until it has n of them, whatever poolLimit is
+        void fillPool(int n) {
+            while (poolSize < n) {
+                node *p = allocNode();
+                p->nodeSize = 0;
+                p->next = pool;
+                pool = p;
+                poolSize++;
+            }
+        }
+
+        //free the nodes in the pool until there are at most n of them, the reserved ones
+        //are kept (see reserve_back())
+        void trimPool(int n) {
+            if (n < reservedBack + reservedFront) n = reservedBack + reservedFront;
+            while (poolSize > n) {
+                node *p = pool;
+                pool = pool->next;
+                poolSize--;
+                freeNode(p);
+            }
+        }
+
+        void init() {
+            initEmpty();
+            revive();
+        }
+
+        //set the members of an empty deque without any node, nothing is allocated
+        void initEmpty() {
+            pool = NULL;
+            poolSize = 0;
+            poolLimit = 2;
+            reservedBack = reservedFront = 0;
+            head = tail = NULL;
+            length = 0;
+            relocations = 0;
+            compactRank = 0;
+        }
+
+        //a deque which has been moved from has no node (head == NULL) until it is changed,
+        //then it gets its empty node back
+        void revive() {
+            if (head != NULL) return;
+            head = tail = newNode(NULL, NULL);
+            buildIndex();
+        }
+
+        //the node which the const iterators of a deque without any node point to
+        static const node *emptyNode() {
+            static const node empty = node();
+            return &empty;
+        }
+
+        //delete all of the nodes, the deque is left without any
+        void releaseNodes() {
             node *tmp = head;
             node *del;
             while (tmp) {
                 del = tmp;
                 tmp = tmp->next;
-                delete del;
+                deleteNode(del);
             }
-            head = tail = new node(nodeLength, NULL, NULL);
+            head = tail = NULL;
             length = 0;
         }
 
+        //clear all of the nodes
+        void clearAll() {
+            if (head == NULL) return;
+            releaseNodes();
+            revive();
+        }
+
+        //node index, a Fenwick tree over slots which hold the nodes in the order of the list,
+        //with free slots between them. the rank of the first element of a node is the sum of
+        //the sizes in the slots before it, and the node of a rank is found by a descent of the
+        //tree, both are O(log nodes) and only read the index. a new node takes a free slot next
+        //to its neighbour, the slots are laid out again when there is none.
+        std::vector<node *> slots; //NULL for a free slot
+        std::vector<int> sizes;    //the size of the node in each slot
+        std::vector<int> tree;     //tree[i] is the sum of sizes[i - (i & -i), i)
+
+        //lay the slots out again: a free slot after each node, count + 8 of them before the head
+        //and after the tail (count is the number of nodes), and at least room of them after gap,
+        //or before the head if gap is NULL.
+        void buildIndex(const node *gap = NULL, int room = 1) {
+            int count = 0;
+            for (node *p = head; p != NULL; p = p->next) count++;
+            room += count / 8;
+            int margin = count + 8;
+            int n = 2 * margin + 2 * count + room;
+            slots.assign(n, NULL);
+            sizes.assign(n, 0);
+            tree.assign(n + 1, 0);
+            int s = gap == NULL ? margin + room : margin;
+            for (node *p = head; p != NULL; p = p->next) {
+                p->index = s;
+                slots[s] = p;
+                sizes[s] = p->nodeSize;
+                s += p == gap ? room + 1 : 2;
+            }
+            for (int i = 1; i <= n; i++) {
+                tree[i] += sizes[i - 1];
+                int j = i + (i & -i);
+                if (j <= n) tree[j] += tree[i];
+            }
+            counters.add(event_index_steps, count);
+        }
+
+        //the first of k free slots in a row after p (before the head if p is NULL), the slots
+        //are laid out again if there are not enough. nothing is linked yet, so a throw is harmless.
+        int freeSlots(const node *p, int k) {
+            if (p == NULL) {
+                if (head->index < k) buildIndex(NULL, k);
+                return head->index - k;
+            }
+            int end = p->next != NULL ? p->next->index : (int) slots.size();
+            if (end - p->index <= k) buildIndex(p, k);
+            return p->index + 1;
+        }
+
+        //p has been linked into the list, give it the free slot s
+        void indexLink(node *p, int s) {
+            p->index = s;
+            slots[s] = p;
+            indexResize(p, p->nodeSize);
+        }
+
+        //the rank of the first element of p
+        long long startRank(const node *p) const {
+            long long rank = 0;
+            for (int i = p->index; i > 0; i -= i & -i) rank += tree[i];
+            return rank;
+        }
+
+        //the size of p has been changed by delta
+        void indexResize(node *p, int delta) {
+            if (delta == 0) return;
+            sizes[p->index] += delta;
+            for (int i = p->index + 1; i < (int) tree.size(); i += i & -i) tree[i] += delta;
+        }
+
+        //p is going to be removed from the list
+        void indexRemove(node *p) {
+            indexResize(p, -sizes[p->index]);
+            slots[p->index] = NULL;
+            p->index = -1;
+        }
+
         //search for the NO.rank+1 elements(whose subscript index is rank as well)
-        void search(const int rank, node *&pos, int &nodePos) {
+        void search(const int rank, node *&pos, int &nodePos) const {
             //if the rank exceeds  the scope of dequeue
             if (rank >= length) {
                 pos = NULL;
                 nodePos = -1;
                 return;
             }
-            node *tmp = head;
-            unsigned long long counter = rank + 1; //set a counter
-            //to find the element in which node
-            while (tmp->nodeSize < counter) {
-                counter -= tmp->nodeSize;
-                tmp = tmp->next;
+            counters.add(event_searches, 1);
+            counters.access(rank, length);
+            //descend the tree to the last slot whose prefix sum is at most rank,
+            //the node in the slot after it holds the element
+            int n = (int) sizes.size(), s = 0, rest = rank;
+            int step = 1;
+            while (step * 2 <= n) step *= 2;
+            for (; step > 0; step /= 2) {
+                if (s + step <= n && tree[s + step] <= rest) {
+                    s += step;
+                    rest -= tree[s];
+                }
+                counters.add(event_search_steps, 1);
             }
-            pos = tmp;
-            nodePos = counter - 1;
+            pos = slots[s];
+            nodePos = rest;
+        }
+
+        //move all the elements of p->next to the end of p, then delete p->next
+        void absorbNext(node *p) {
+            node *del = p->next;
+            unshare(p);
+            unshare(del);
+            int moved = del->nodeSize;
+            for (int i = 0; i < moved; i++)
+                block_type::relocate(alloc, p->place(p->nodeSize + i), del->place(i));
+            relocations += moved;
+            p->nodeSize += moved;
+            del->nodeSize = 0;
+            indexResize(p, moved);
+            indexRemove(del);
+            p->next = del->next;
+            if (del->next) del->next->prev = p;
+            else tail = p;
+            deleteNode(del);
+        }
+
+        //take an empty node out of the list (the deque must have another node)
+        void unlink(node *p) {
+            indexRemove(p);
+            if (p->prev) p->prev->next = p->next;
+            else head = p->next;
+            if (p->next) p->next->prev = p->prev;
+            else tail = p->prev;
+            deleteNode(p);
         }
 
 
@@ -87,20 +770,26 @@ namespace sjtu {
         class const_iterator;
 
         class iterator {
-            friend class deque<T>;
+            friend class deque;
 
             friend class const_iterator;
 
         private:
-            deque<T> *que;
+            deque *que;
             node *currentNode;  //pointer, pointing to the current node
             int nodePos;    //store the position in the node, starting from 0
 
         public:
+            typedef std::random_access_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef T *pointer;
+            typedef T &reference;
+
             //construction
             iterator() : que(NULL), currentNode(NULL), nodePos(-1) {}
 
-            iterator(deque<T> *q, node *cn, int np) {
+            iterator(deque *q, node *cn, int np) {
                 que = q;
                 currentNode = cn;
                 nodePos = np;
@@ -126,23 +815,22 @@ namespace sjtu {
             iterator operator+(const int &n) const {
                 if (currentNode == NULL) throw invalid_iterator();
                 if (n < 0) return (*this) - (-n);
-                iterator tmp(*this);
-                int counter = n;
-                while (counter >= tmp.currentNode->nodeSize - tmp.nodePos) {
-                    if (tmp.currentNode->next == NULL) break;
-
-                    counter -= (tmp.currentNode->nodeSize - tmp.nodePos);
-                    //to the next block
-                    tmp.nodePos = 0;
-                    tmp.currentNode = tmp.currentNode->next;
+                //still in the current block
+                if (nodePos + n < currentNode->nodeSize)
+                    return iterator(que, currentNode, nodePos + n);
+                //or in the next one
+                if (currentNode->next != NULL && nodePos + n < currentNode->nodeSize + currentNode->next->nodeSize) {
+                    que->counters.add(event_iterator_steps, 1);
+                    return iterator(que, currentNode->next, nodePos + n - currentNode->nodeSize);
                 }
-                tmp.nodePos += counter;
-                if (tmp.nodePos >= tmp.currentNode->nodeSize) {
-                    if (tmp.currentNode->next == NULL
-                        && tmp.nodePos == tmp.currentNode->nodeSize)
-                        return tmp;
-                    tmp.currentNode = NULL;
-                    tmp.nodePos = -1;
+                //else find it by rank with the node index
+                long long rank = que->startRank(currentNode) + nodePos + n;
+                if (rank == que->length) return que->end();
+                iterator tmp(que, NULL, -1);
+                if (rank < que->length) {
+                    node *pos;
+                    que->search(rank, pos, tmp.nodePos);
+                    tmp.currentNode = pos;
                 }
                 return tmp;
             }
@@ -152,59 +840,41 @@ namespace sjtu {
             iterator operator-(const int &n) const {
                 if (currentNode == NULL) throw invalid_iterator();
                 if (n < 0) return (*this) + (-n);
-                iterator tmp(*this);
-                int counter = n;
-                while (counter > tmp.nodePos) {
-                    if (tmp.currentNode->prev == NULL) break;
-
-                    counter -= tmp.nodePos + 1;
-                    //to the previous block
-                    tmp.nodePos = tmp.currentNode->prev->nodeSize - 1;
-                    tmp.currentNode = tmp.currentNode->prev;
-                }
-                tmp.nodePos -= counter;
-                if (tmp.nodePos < 0) {
-                    tmp.currentNode = NULL;
-                    tmp.nodePos = -1;
+                //still in the current block
+                if (nodePos - n >= 0)
+                    return iterator(que, currentNode, nodePos - n);
+                //else find it by rank with the node index
+                long long rank = que->startRank(currentNode) + nodePos - n;
+                iterator tmp(que, NULL, -1);
+                if (rank >= 0) {
+                    node *pos;
+                    que->search(rank, pos, tmp.nodePos);
+                    tmp.currentNode = pos;
                 }
                 return tmp;
             }
 
             // return the distance between two iterator,
             // if these two iterators points to different vectors, throw invaild_iterator.
-            int operator-(const iterator &rhs) const {
+            //the ranks of the nodes come from the node index in O(log nodes).
+            difference_type operator-(const iterator &rhs) const {
                 if (que != rhs.que) throw invalid_iterator();
+                if (currentNode == NULL || rhs.currentNode == NULL) throw invalid_iterator();
+                if (currentNode == rhs.currentNode) return nodePos - rhs.nodePos;
+                return que->startRank(currentNode) + nodePos - que->startRank(rhs.currentNode) - rhs.nodePos;
+            }
 
-                int counter = 0;
-                node *p = currentNode, *q = rhs.currentNode;
-                if (p == q) return nodePos - rhs.nodePos;
-
-                //if p is before q
-                while (p != NULL && q != NULL) {
-                    if (p == q) break;
-                    counter += p->nodeSize;
-                    p = p->next;
-                }
-                if (p != NULL) return -(counter + rhs.nodePos - nodePos);
-
-                //if p is after q
-                p = currentNode, q = rhs.currentNode;
-                counter = 0;
-                while (p != NULL && q != NULL) {
-                    if (p == q) break;
-                    counter += q->nodeSize;
-                    q = q->next;
-                }
-                return counter - rhs.nodePos + nodePos;
-
+            //the distance to a const_iterator, as in d.end() - d.cbegin()
+            difference_type operator-(const const_iterator &rhs) const {
+                return const_iterator(*this) - rhs;
             }
 
-            iterator operator+=(const int &n) {
+            iterator &operator+=(const int &n) {
                 (*this) = (*this) + n;
                 return *this;
             }
 
-            iterator operator-=(const int &n) {
+            iterator &operator-=(const int &n) {
                 *this = (*this) - n;
                 return *this;
             }
@@ -212,46 +882,69 @@ namespace sjtu {
             //iterator++
             iterator operator++(int) {
                 iterator tmp(*this);
-                (*this) += 1;
+                ++(*this);
                 return tmp;
             }
 
-            //++iterator
+            //++iterator, a step inside the node, or to the first element of the next one.
+            //past end() the iterator gets invalid.
             iterator &operator++() {
-                (*this) += 1;
+                SJTU_DEQUE_CHECK(currentNode != NULL);
+                if (++nodePos < currentNode->nodeSize) return *this;
+                if (nodePos == currentNode->nodeSize) {
+                    if (currentNode->next != NULL) {
+                        currentNode = currentNode->next;
+                        nodePos = 0;
+                    }
+                    return *this;
+                }
+                currentNode = NULL;
+                nodePos = -1;
                 return *this;
             }
 
             iterator operator--(int) {
                 iterator tmp(*this);
-                (*this) -= 1;
+                --(*this);
                 return tmp;
             }
 
+            //--iterator, before begin() the iterator gets invalid
             iterator &operator--() {
-                (*this) -= 1;
+                SJTU_DEQUE_CHECK(currentNode != NULL);
+                if (--nodePos >= 0) return *this;
+                if (currentNode->prev != NULL) {
+                    currentNode = currentNode->prev;
+                    nodePos = currentNode->nodeSize - 1;
+                    return *this;
+                }
+                currentNode = NULL;
+                nodePos = -1;
                 return *this;
             }
 
+            //n + iter
+            friend iterator operator+(const int &n, const iterator &rhs) {
+                return rhs + n;
+            }
+
+            //the element n after this one
+            T &operator[](const int &n) const {
+                return *((*this) + n);
+            }
+
             //*iter->field
             T &operator*() const {
-                if (que == NULL) throw invalid_iterator();
-                if (currentNode == NULL) throw invalid_iterator();
-                if (nodePos >= currentNode->nodeSize
-                    || nodePos < 0)
-                    throw invalid_iterator();
-
-                return *(currentNode->data[nodePos]);
+                SJTU_DEQUE_CHECK(currentNode != NULL && nodePos >= 0 && nodePos < currentNode->nodeSize);
+                if (copyOnWrite) que->unshare(currentNode);
+                return *(currentNode->at(nodePos));
             }
 
             //iter->field
-            T *operator->() const noexcept {
-                if (que == NULL) throw invalid_iterator();
-                if (currentNode == NULL) throw invalid_iterator();
-                if (nodePos >= currentNode->nodeSize
-                    || nodePos < 0)
-                    throw invalid_iterator();
-                return (currentNode->data[nodePos]);
+            T *operator->() const {
+                SJTU_DEQUE_CHECK(currentNode != NULL && nodePos >= 0 && nodePos < currentNode->nodeSize);
+                if (copyOnWrite) que->unshare(currentNode);
+                return currentNode->at(nodePos);
             }
 
             //a operator to check whether two iterators are same
@@ -276,23 +969,94 @@ namespace sjtu {
             bool operator!=(const const_iterator &rhs) const {
                 return !(*this == rhs);
             }
+
+            //iterators are ordered by their positions, they must belong to the same deque
+            bool operator<(const const_iterator &rhs) const {
+                return const_iterator(*this) < rhs;
+            }
+
+            bool operator>(const const_iterator &rhs) const {
+                return rhs < *this;
+            }
+
+            bool operator<=(const const_iterator &rhs) const {
+                return !(rhs < *this);
+            }
+
+            bool operator>=(const const_iterator &rhs) const {
+                return !(const_iterator(*this) < rhs);
+            }
+
+            //segmented access: the number of elements from this one on that are next to each other
+            //in memory, [&*it, &*it + segment_size()) is a plain array inside the node.
+            //it is 1 with boxed_storage, and 0 at end().
+            int segment_size() const {
+                if (currentNode == NULL) throw invalid_iterator();
+                int n = currentNode->nodeSize - nodePos;
+                if (n <= 0) return 0;
+                if (!Storage::contiguous) return 1;
+                int k = currentNode->start + nodePos;
+                if (k >= nodeLength) k -= nodeLength;
+                return n < nodeLength - k ? n : nodeLength - k;
+            }
+
+            //copy, fill and find work one segment at a time with the std algorithms on plain
+            //pointers, so that they can use memmove or vectorized loops.
+            //call them unqualified, they are found by argument-dependent lookup.
+            template<class OutputIt>
+            friend OutputIt copy(iterator first, iterator last, OutputIt out) {
+                return copy(const_iterator(first), const_iterator(last), out);
+            }
+
+            template<class U>
+            friend void fill(iterator first, iterator last, const U &value) {
+                for (int n = last - first; n > 0;) {
+                    int k = first.segment_size();
+                    if (k > n) k = n;
+                    first.que->unshare(first.currentNode);
+                    T *p = first.currentNode->at(first.nodePos);
+                    std::fill(p, p + k, value);
+                    first += k;
+                    n -= k;
+                }
+            }
+
+            template<class U>
+            friend iterator find(iterator first, iterator last, const U &value) {
+                for (int n = last - first; n > 0;) {
+                    int k = first.segment_size();
+                    if (k > n) k = n;
+                    T *p = first.currentNode->at(first.nodePos);
+                    T *q = std::find(p, p + k, value);
+                    if (q != p + k) return iterator(first.que, first.currentNode, first.nodePos + int(q - p));
+                    first += k;
+                    n -= k;
+                }
+                return last;
+            }
         };
 
         class const_iterator {
             friend class iterator;
 
-            friend class deque<T>;
+            friend class deque;
 
         private:
-            const deque<T> *que;
+            const deque *que;
             const node *currentNode;  //pointer, pointing to the current node
             int nodePos;    //store the position in the node, starting from 0
 
         public:
+            typedef std::random_access_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const T *pointer;
+            typedef const T &reference;
+
             //construction
             const_iterator() : que(NULL), currentNode(NULL), nodePos(-1) {}
 
-            const_iterator(const deque<T> *q, const node *cn, int np) {
+            const_iterator(const deque *q, const node *cn, int np) {
                 que = q;
                 currentNode = cn;
                 nodePos = np;
@@ -324,23 +1088,22 @@ namespace sjtu {
             const_iterator operator+(const int &n) const {
                 if (currentNode == NULL) throw invalid_iterator();
                 if (n < 0) return (*this) - (-n);
-                const_iterator tmp(*this);
-                int counter = n;
-                while (counter >= tmp.currentNode->nodeSize - tmp.nodePos) {
-                    if (tmp.currentNode->next == NULL) break;
-
-                    counter -= (tmp.currentNode->nodeSize - tmp.nodePos);
-                    //to the next block
-                    tmp.nodePos = 0;
-                    tmp.currentNode = tmp.currentNode->next;
+                //still in the current block
+                if (nodePos + n < currentNode->nodeSize)
+                    return const_iterator(que, currentNode, nodePos + n);
+                //or in the next one
+                if (currentNode->next != NULL && nodePos + n < currentNode->nodeSize + currentNode->next->nodeSize) {
+                    que->counters.add(event_iterator_steps, 1);
+                    return const_iterator(que, currentNode->next, nodePos + n - currentNode->nodeSize);
                 }
-                tmp.nodePos += counter;
-                if (tmp.nodePos >= tmp.currentNode->nodeSize) {
-                    if (tmp.currentNode->next == NULL
-                        && tmp.nodePos == tmp.currentNode->nodeSize)
-                        return tmp;
-                    tmp.currentNode = NULL;
-                    tmp.nodePos = -1;
+                //else find it by rank with the node index
+                long long rank = que->startRank(currentNode) + nodePos + n;
+                if (rank == que->length) return que->cend();
+                const_iterator tmp(que, NULL, -1);
+                if (rank < que->length) {
+                    node *pos;
+                    que->search(rank, pos, tmp.nodePos);
+                    tmp.currentNode = pos;
                 }
                 return tmp;
             }
@@ -350,59 +1113,37 @@ namespace sjtu {
             const_iterator operator-(const int &n) const {
                 if (currentNode == NULL) throw invalid_iterator();
                 if (n < 0) return (*this) + (-n);
-                const_iterator tmp(*this);
-                int counter = n;
-                while (counter > tmp.nodePos) {
-                    if (tmp.currentNode->prev == NULL) break;
-
-                    counter -= tmp.nodePos + 1;
-                    //to the previous block
-                    tmp.nodePos = tmp.currentNode->prev->nodeSize - 1;
-                    tmp.currentNode = tmp.currentNode->prev;
-                }
-                tmp.nodePos -= counter;
-                if (tmp.nodePos < 0) {
-                    tmp.currentNode = NULL;
-                    tmp.nodePos = -1;
+                //still in the current block
+                if (nodePos - n >= 0)
+                    return const_iterator(que, currentNode, nodePos - n);
+                //else find it by rank with the node index
+                long long rank = que->startRank(currentNode) + nodePos - n;
+                const_iterator tmp(que, NULL, -1);
+                if (rank >= 0) {
+                    node *pos;
+                    que->search(rank, pos, tmp.nodePos);
+                    tmp.currentNode = pos;
                 }
                 return tmp;
             }
 
             // return the distance between two iterator,
             // if these two iterators points to different vectors, throw invaild_iterator.
-            int operator-(const const_iterator &rhs) const {
+            //the ranks of the nodes come from the node index in O(log nodes).
+            //a const_iterator minus an iterator converts the iterator
+            difference_type operator-(const const_iterator &rhs) const {
                 if (que != rhs.que) throw invalid_iterator();
-
-                int counter = 0;
-                const node *p = currentNode, *q = rhs.currentNode;
-                if (p == q) return nodePos - rhs.nodePos;
-
-                //if p is before q
-                while (p != NULL && q != NULL) {
-                    if (p == q) break;
-                    counter += p->nodeSize;
-                    p = p->next;
-                }
-                if (p != NULL) return -(counter + rhs.nodePos - nodePos);
-
-                //if p is after q
-                p = currentNode, q = rhs.currentNode;
-                counter = 0;
-                while (p != NULL && q != NULL) {
-                    if (p == q) break;
-                    counter += q->nodeSize;
-                    q = q->next;
-                }
-                return counter - rhs.nodePos + nodePos;
-
+                if (currentNode == NULL || rhs.currentNode == NULL) throw invalid_iterator();
+                if (currentNode == rhs.currentNode) return nodePos - rhs.nodePos;
+                return que->startRank(currentNode) + nodePos - que->startRank(rhs.currentNode) - rhs.nodePos;
             }
 
-            const_iterator operator+=(const int &n) {
+            const_iterator &operator+=(const int &n) {
                 (*this) = (*this) + n;
                 return *this;
             }
 
-            const_iterator operator-=(const int &n) {
+            const_iterator &operator-=(const int &n) {
                 *this = (*this) - n;
                 return *this;
             }
@@ -410,46 +1151,67 @@ namespace sjtu {
             //iterator++
             const_iterator operator++(int) {
                 const_iterator tmp(*this);
-                (*this) += 1;
+                ++(*this);
                 return tmp;
             }
 
-            //++iterator
+            //++iterator, a step inside the node, or to the first element of the next one.
+            //past end() the iterator gets invalid.
             const_iterator &operator++() {
-                (*this) += 1;
+                SJTU_DEQUE_CHECK(currentNode != NULL);
+                if (++nodePos < currentNode->nodeSize) return *this;
+                if (nodePos == currentNode->nodeSize) {
+                    if (currentNode->next != NULL) {
+                        currentNode = currentNode->next;
+                        nodePos = 0;
+                    }
+                    return *this;
+                }
+                currentNode = NULL;
+                nodePos = -1;
                 return *this;
             }
 
             const_iterator operator--(int) {
                 const_iterator tmp(*this);
-                (*this) -= 1;
+                --(*this);
                 return tmp;
             }
 
+            //--iterator, before begin() the iterator gets invalid
             const_iterator &operator--() {
-                (*this) -= 1;
+                SJTU_DEQUE_CHECK(currentNode != NULL);
+                if (--nodePos >= 0) return *this;
+                if (currentNode->prev != NULL) {
+                    currentNode = currentNode->prev;
+                    nodePos = currentNode->nodeSize - 1;
+                    return *this;
+                }
+                currentNode = NULL;
+                nodePos = -1;
                 return *this;
             }
 
-            //*iter->field
-            T &operator*() const {
-                if (que == NULL) throw invalid_iterator();
-                if (currentNode == NULL) throw invalid_iterator();
-                if (nodePos >= currentNode->nodeSize
-                    || nodePos < 0)
-                    throw invalid_iterator();
+            //n + iter
+            friend const_iterator operator+(const int &n, const const_iterator &rhs) {
+                return rhs + n;
+            }
+
+            //the element n after this one
+            const T &operator[](const int &n) const {
+                return *((*this) + n);
+            }
 
-                return *(currentNode->data[nodePos]);
+            //*iter->field
+            const T &operator*() const {
+                SJTU_DEQUE_CHECK(currentNode != NULL && nodePos >= 0 && nodePos < currentNode->nodeSize);
+                return *(currentNode->at(nodePos));
             }
 
             //iter->field
-            T *operator->() const noexcept {
-                if (que == NULL) throw invalid_iterator();
-                if (currentNode == NULL) throw invalid_iterator();
-                if (nodePos >= currentNode->nodeSize
-                    || nodePos < 0)
-                    throw invalid_iterator();
-                return (currentNode->data[nodePos]);
+            const T *operator->() const {
+                SJTU_DEQUE_CHECK(currentNode != NULL && nodePos >= 0 && nodePos < currentNode->nodeSize);
+                return currentNode->at(nodePos);
             }
 
             //a operator to check whether two iterators are same
@@ -475,97 +1237,259 @@ namespace sjtu {
                 return !(*this == rhs);
             }
 
-        };
+            //iterators are ordered by their positions, they must belong to the same deque
+            bool operator<(const const_iterator &rhs) const {
+                return (*this) - rhs < 0;
+            }
 
-        //construction
-        deque() {
-            head = tail = new node(nodeLength, NULL, NULL);
-            length = 0;
-        }
+            bool operator>(const const_iterator &rhs) const {
+                return rhs < *this;
+            }
 
-        deque(const deque &other) {
-            node *p = head = new node(nodeLength, NULL, NULL);
-            node *q = other.head;
-            length = other.length;
-            p->nodeSize = q->nodeSize;
-            if (length == 0) {
-                tail = head;
-                return;
+            bool operator<=(const const_iterator &rhs) const {
+                return !(rhs < *this);
             }
-            while (q != NULL) {
-                p->nodeSize = q->nodeSize;
-                for (int i = 0; i < q->nodeSize; i++) {
-                    p->data[i] = new T(*(q->data[i]));
-                }
-                p = p->next = new node(nodeLength, p, NULL);
-                q = q->next;
+
+            bool operator>=(const const_iterator &rhs) const {
+                return !((*this) < rhs);
             }
-            tail = p->prev;
-            tail->next = NULL;
-            delete p;
-        }
 
-        //destruction
-        ~deque() {
-            if (this != NULL) {
-                clearAll();
-                delete head;
+            //segmented access: the number of elements from this one on that are next to each other
+            //in memory, [&*it, &*it + segment_size()) is a plain array inside the node.
+            //it is 1 with boxed_storage, and 0 at end().
+            int segment_size() const {
+                if (currentNode == NULL) throw invalid_iterator();
+                int n = currentNode->nodeSize - nodePos;
+                if (n <= 0) return 0;
+                if (!Storage::contiguous) return 1;
+                int k = currentNode->start + nodePos;
+                if (k >= nodeLength) k -= nodeLength;
+                return n < nodeLength - k ? n : nodeLength - k;
             }
-        }
 
-        //overload operator =
-        deque &operator=(const deque &other) {
-            if (this == &other) return *this;
-            clearAll();
-            node *p = head;
-            node *q = other.head;
-            length = other.length;
-            p->nodeSize = q->nodeSize;
-            if (length == 0) {
-                tail = head;
-                return *this;
+            //see iterator
+            template<class OutputIt>
+            friend OutputIt copy(const_iterator first, const_iterator last, OutputIt out) {
+                for (int n = last - first; n > 0;) {
+                    int k = first.segment_size();
+                    if (k > n) k = n;
+                    const T *p = first.currentNode->at(first.nodePos);
+                    out = std::copy(p, p + k, out);
+                    first += k;
+                    n -= k;
+                }
+                return out;
             }
-            while (q != NULL) {
-                p->nodeSize = q->nodeSize;
-                for (int i = 0; i < p->nodeSize; i++) {
-                    p->data[i] = new T(*(q->data[i]));
+
+            template<class U>
+            friend const_iterator find(const_iterator first, const_iterator last, const U &value) {
+                for (int n = last - first; n > 0;) {
+                    int k = first.segment_size();
+                    if (k > n) k = n;
+                    const T *p = first.currentNode->at(first.nodePos);
+                    const T *q = std::find(p, p + k, value);
+                    if (q != p + k)
+                        return const_iterator(first.que, first.currentNode, first.nodePos + int(q - p));
+                    first += k;
+                    n -= k;
                 }
-                p = p->next = new node(nodeLength, p, NULL);
-                q = q->next;
+                return last;
             }
-            tail = p->prev;
-            tail->next = NULL;
-            delete p;
-            return *this;
+        };
+
+        //construction
+        deque() : alloc() {
+            init();
         }
 
-        //access specified element with bounds checking
-        //throw index_out_of_bound if out of bound.
+        explicit deque(const Allocator &a) : alloc(a) {
+            init();
+        }
+
+        //constructs with count copies of value
+        deque(size_t count, const T &value, const Allocator &a = Allocator()) : alloc(a) {
+            init();
+            try {
+                insert(end(), count, value);
+            } catch (...) {
+                destroyAll();
+                throw;
+            }
+        }
+
+        //constructs with count default-constructed elements
+        explicit deque(size_t count, const Allocator &a = Allocator()) : alloc(a) {
+            init();
+            try {
+                for (size_t i = 0; i < count; i++) emplace_back();
+            } catch (...) {
+                destroyAll();
+                throw;
+            }
+        }
+
+        //constructs with the elements in [first, last)
+        template<class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+        deque(InputIt first, InputIt last, const Allocator &a = Allocator()) : alloc(a) {
+            init();
+            try {
+                insert(end(), first, last);
+            } catch (...) {
+                destroyAll();
+                throw;
+            }
+        }
+
+        deque(const deque &other)
+                : alloc(alloc_traits::select_on_container_copy_construction(other.alloc)) {
+            init();
+            try {
+                copyFrom(other);
+            } catch (...) {
+                destroyAll();
+                throw;
+            }
+        }
+
+        //steal the nodes of other without allocating anything, other is left empty without
+        //any node until it is changed again
+        deque(deque &&other) noexcept : alloc(std::move(other.alloc)) {
+            initEmpty();
+            swapNodes(other);
+        }
+
+        //destruction
+        ~deque() {
+            destroyAll();
+        }
+
+        //overload operator =
+        deque &operator=(const deque &other) {
+            if (this == &other) return *this;
+            if (alloc_traits::propagate_on_container_copy_assignment::value && !(alloc == other.alloc)) {
+                //the nodes must be given back to the allocator they come from
+                destroyAll();
+                alloc = other.alloc;
+                int limit = poolLimit;
+                init();
+                poolLimit = limit;
+            } else clearAll();
+            copyFrom(other);
+            return *this;
+        }
+
+        //the nodes of other are taken without allocating anything when the allocator propagates
+        //or the allocators are equal (an allocator without state is taken as always equal)
+        deque &operator=(deque &&other)
+                noexcept(alloc_traits::propagate_on_container_move_assignment::value || std::is_empty<Allocator>::value) {
+            if (this == &other) return *this;
+            if (alloc_traits::propagate_on_container_move_assignment::value || alloc == other.alloc) {
+                releaseNodes();
+                if (!(alloc == other.alloc)) {
+                    //the pool must be given back to the allocator it comes from
+                    reservedBack = reservedFront = 0;
+                    trimPool(0);
+                    alloc = std::move(other.alloc);
+                }
+                swapNodes(other);
+            } else {
+                //the nodes of other can not be freed by this allocator, move the elements one by one
+                clearAll();
+                for (node *q = other.head; q != NULL; q = q->next) {
+                    other.unshare(q);
+                    for (int i = 0; i < q->nodeSize; i++)
+                        emplace_back(std::move(*(q->at(i))));
+                }
+                other.clearAll();
+            }
+            return *this;
+        }
+
+        //exchange the contents of two deques in O(1).
+        //the iterators keep pointing to their elements, but they are tied to the other deque now.
+        void swap(deque &other) {
+            if (this == &other) return;
+            std::swap(alloc, other.alloc);
+            std::swap(pool, other.pool);
+            std::swap(poolSize, other.poolSize);
+            std::swap(poolLimit, other.poolLimit);
+            std::swap(reservedBack, other.reservedBack);
+            std::swap(reservedFront, other.reservedFront);
+            swapNodes(other);
+        }
+
+        allocator_type get_allocator() const { return alloc; }
+
+        //a copy of the deque, which only shares the blocks with copy_on_write_policy
+        deque snapshot() const { return *this; }
+
+        //the max number of freed nodes kept for reuse (2 by default)
+        size_t pool_limit() const { return poolLimit; }
+
+        void set_pool_limit(size_t n) {
+            poolLimit = n;
+            trimPool(poolLimit);
+        }
+
+        //the number of elements the nodes in the list and in the pool have room for
+        size_t capacity() const {
+            size_t n = poolSize;
+            for (const node *p = head; p != NULL; p = p->next) n++;
+            return n * nodeLength;
+        }
+
+        //make sure that the next n push_back() (or emplace_back()) calls do not allocate: the
+        //nodes they need after the room in the tail are allocated now and kept in the pool.
+        //the nodes kept for reserve_front() are not counted, and the nodes are kept even over
+        //pool_limit() until the back takes them or shrink_to_fit() drops them. any other operation
+        //may take them as well, and with copy_on_write_policy a shared tail block is still copied.
+        void reserve_back(size_t n) {
+            //the room of a single node may be taken by the other end
+            int room = head == tail ? 0 : nodeLength - tail->nodeSize;
+            reservedBack = n <= (size_t) room ? 0 : (int) ((n - room + nodeLength - 1) / nodeLength);
+            fillPool(reservedBack + reservedFront);
+        }
+
+        //the same as reserve_back() for push_front() and emplace_front()
+        void reserve_front(size_t n) {
+            int room = head == tail ? 0 : nodeLength - head->nodeSize;
+            reservedFront = n <= (size_t) room ? 0 : (int) ((n - room + nodeLength - 1) / nodeLength);
+            fillPool(reservedBack + reservedFront);
+        }
+
+        //the counters since the deque was made or reset_stats() was called (all 0 unless the
+        //policy has statistics, see statistics_policy), and the fill of the nodes now.
+        deque_stats stats() const {
+            deque_stats res = deque_stats();
+            counters.get(res);
+            for (const node *p = head; p != NULL; p = p->next) {
+                res.nodes++;
+                if (p->nodeSize > res.max_fill) res.max_fill = p->nodeSize;
+                res.fill_histogram[p->nodeSize * deque_stats::buckets / (nodeLength + 1)]++;
+            }
+            res.average_fill = res.nodes == 0 ? 0 : (double) length / res.nodes;
+            return res;
+        }
+
+        void reset_stats() { counters.reset(); }
+
+        //access specified element with bounds checking
+        //throw index_out_of_bound if out of bound.
         T &at(const size_t &pos) {
             if (pos >= length) throw index_out_of_bound();
             node *currentNode;
             int nodePos;
             search(pos, currentNode, nodePos);
-            return *(currentNode->data[nodePos]);
+            unshare(currentNode);
+            return *(currentNode->at(nodePos));
         }
 
         const T &at(const size_t &pos) const {
-
             if (pos >= length) throw index_out_of_bound();
             node *currentNode;
             int nodePos;
-
-            node *tmp = head;
-            unsigned long long counter = pos + 1; //set a counter
-            //to find the element in which node
-            while (tmp->nodeSize < counter) {
-                counter -= tmp->nodeSize;
-                tmp = tmp->next;
-            }
-            currentNode = tmp;
-            nodePos = counter - 1;
-            //search(int(pos), currentNode, nodePos);
-            return *(currentNode->data[nodePos]);
+            search(pos, currentNode, nodePos);
+            return *(currentNode->at(nodePos));
         }
 
         T &operator[](const size_t &pos) {
@@ -573,59 +1497,57 @@ namespace sjtu {
             node *currentNode;
             int nodePos;
             search(pos, currentNode, nodePos);
-            return *(currentNode->data[nodePos]);
+            unshare(currentNode);
+            return *(currentNode->at(nodePos));
         }
 
         const T &operator[](const size_t &pos) const {
             if (pos >= length) throw index_out_of_bound();
             node *currentNode;
             int nodePos;
-
-            node *tmp = head;
-            unsigned long long counter = pos + 1; //set a counter
-            //to find the element in which node
-            while (tmp->nodeSize < counter) {
-                counter -= tmp->nodeSize;
-                tmp = tmp->next;
-            }
-            currentNode = tmp;
-            nodePos = counter - 1;
-            //search(pos, currentNode, nodePos);
-            return *(currentNode->data[nodePos]);
+            search(pos, currentNode, nodePos);
+            return *(currentNode->at(nodePos));
         }
 
         //access the first element
         // throw container_is_empty when the container is empty
         const T &front() const {
             if (length == 0) throw container_is_empty();
-            return *(head->data[0]);
+            return *(head->at(0));
         }
 
         //access the last element
         //throw container_is_empty when the container is empty.
         const T &back() const {
             if (length == 0) throw container_is_empty();
-            return *(tail->data[tail->nodeSize - 1]);
+            return *(tail->at(tail->nodeSize - 1));
         }
 
         //returns an iterator to the beginning.
         iterator begin() {
+            revive();
             iterator it(this, head, 0);
             return it;
         }
 
+        const_iterator begin() const { return cbegin(); }
+
         const_iterator cbegin() const {
-            const_iterator it(this, head, 0);
+            const_iterator it(this, head != NULL ? head : emptyNode(), 0);
             return it;
         }
 
         //returns an iterator to the end.
         iterator end() {
+            revive();
             iterator it(this, tail, tail->nodeSize);
             return it;
         }
 
+        const_iterator end() const { return cend(); }
+
         const_iterator cend() const {
+            if (tail == NULL) return cbegin();
             const_iterator it(this, tail, tail->nodeSize);
             return it;
         }
@@ -636,84 +1558,139 @@ namespace sjtu {
         //returns the number of elements
         size_t size() const { return length; }
 
+        //the number of times the last insert, emplace or erase has moved an element to another
+        //slot, within its node or to another node. an element moved twice (lent to a neighbour,
+        //then shifted for the new element) counts twice, the inserted and erased ones not at all.
+        size_t relocated() const { return relocations; }
+
         //clears the contents
         void clear() { clearAll(); }
 
-        //inserts elements at the specified location on in the container.
-        //inserts value before pos
-        //returns an iterator pointing to the inserted value
-        //throw if the iterator is invalid or it point to a wrong place.
-        iterator insert(iterator pos, const T &value) {
-            if (pos.que != this) throw invalid_iterator();
-            if (pos.currentNode == NULL) throw invalid_iterator();
-            if (pos.currentNode == tail && (pos.nodePos > pos.currentNode->nodeSize
-                                            || pos.nodePos < 0))
-                throw invalid_iterator();
-            if (pos.currentNode != tail && (pos.nodePos >= pos.currentNode->nodeSize
-                                            || pos.nodePos < 0))
-                throw invalid_iterator();
-
-            length++;
+        //packs the nodes so that every node but the last one is full, keeping the order of the
+        //elements, and frees the nodes that are left empty and the pool, whose reserved nodes
+        //(see reserve_back()) are dropped as well. iterators are invalidated.
+        void shrink_to_fit() {
+            compactRank = 0;
+            compact();
+            reservedBack = reservedFront = 0;
+            trimPool(0);
+        }
 
-            for (int i = pos.currentNode->nodeSize; i > pos.nodePos; i--) {
-                pos.currentNode->data[i] = pos.currentNode->data[i - 1];
-                pos.currentNode->data[i - 1] = NULL;
+        //packs the nodes from the front like shrink_to_fit(), but moves at most budget elements
+        //(0 for no limit) and goes on where the last call has stopped, so the work can be done in
+        //small slices. returns true when the end has been reached, the next call starts over then.
+        //the emptied nodes go to the pool. iterators are invalidated if anything is moved.
+        bool compact(size_t budget = 0) {
+            if (compactRank >= length) compactRank = 0;
+            if (length == 0) return true;
+            node *p;
+            int pos;
+            search(compactRank, p, pos);
+            long long rank = compactRank - pos;   //the rank of the first element of p
+            size_t left = budget;
+            while (p->next != NULL) {
+                if (p->nodeSize == nodeLength) {
+                    rank += p->nodeSize;
+                    p = p->next;
+                    continue;
+                }
+                if (budget != 0 && left == 0) {
+                    compactRank = (int) rank;
+                    return false;
+                }
+                node *n = p->next;
+                int k = std::min(nodeLength - p->nodeSize, n->nodeSize);
+                if (budget != 0 && (size_t) k > left) k = (int) left;
+                moveAcross(p, -k);
+                left -= k;
+                if (n->nodeSize == 0) unlink(n);
             }
-            pos.currentNode->data[pos.nodePos] = new T(value);
-            pos.currentNode->nodeSize++;
+            compactRank = 0;
+            return true;
+        }
+
+        //a run of neighbouring slots of a node, see for_each_segment()
+        template<class U>
+        struct span {
+            U *first, *last;
 
-            if (pos.currentNode->nodeSize == nodeLength) {
-                T *place = pos.currentNode->data[pos.nodePos];
-                iterator tmp(this, pos.currentNode, 0);
-                split(pos.currentNode);
+            span(U *f, U *l) : first(f), last(l) {}
 
-                while (tmp.currentNode->data[tmp.nodePos] != place) {
-                    tmp++;
+            U *begin() const { return first; }
+
+            U *end() const { return last; }
+
+            size_t size() const { return last - first; }
+
+            U &operator[](size_t i) const { return first[i]; }
+        };
+
+        //with inline_storage a segment holds the elements themselves, with boxed_storage it
+        //holds the pointers to them.
+        typedef span<typename block_type::span_type> segment;
+        typedef span<typename block_type::const_span_type> const_segment;
+
+        //call f(segment) for every contiguous run of elements in order, at most two per node
+        //(the block is a ring buffer), so that f can run a plain loop over an array.
+        //f must not insert or erase elements.
+        template<class F>
+        void for_each_segment(F f) {
+            for (node *p = head; p != NULL; p = p->next) {
+                if (p->nodeSize == 0) continue;
+                unshare(p);
+                int k = nodeLength - p->start;
+                if (k > p->nodeSize) k = p->nodeSize;
+                typename block_type::span_type *a = block_type::span(p->place(0));
+                f(segment(a, a + k));
+                if (k < p->nodeSize) {
+                    a = block_type::span(p->data);
+                    f(segment(a, a + p->nodeSize - k));
                 }
-                return tmp;
-            } else {
-                return pos;
             }
+        }
 
-            /*if(tail->nodeSize == nodeLength && pos == this->end()){
-                tail = tail->next = new node(nodeLength, tail, NULL);
-                tail->data[0] = new T(value);
-                tail->nodeSize++;
-                pos.currentNode = tail;
-                pos.nodePos = 0;
-                return pos;
-            }
-            else if(tail->nodeSize != nodeLength && pos == this->end()){
-                tail->data[tail->nodeSize] = new T(value);
-                tail->nodeSize++;
-                return pos;
-            }
-            else;
-
-            node *tmpNode = pos.currentNode;
-            int tmpNodePos = pos.nodePos;
-            if(tmpNode->nodeSize == nodeLength){
-                tmpNode->next = new node(nodeLength,tmpNode,tmpNode->next);
-                if(tmpNode->next->next) tmpNode->next->next->prev =tmpNode->next;
-                for(int i = tmpNodePos;i < tmpNode->nodeSize;i++){
-                    tmpNode->next->data[i-tmpNodePos] = new T(*tmpNode->data[i]);
-                    delete tmpNode->data[i];
-                    tmpNode->data[i] = NULL;
+        template<class F>
+        void for_each_segment(F f) const {
+            for (const node *p = head; p != NULL; p = p->next) {
+                if (p->nodeSize == 0) continue;
+                int k = nodeLength - p->start;
+                if (k > p->nodeSize) k = p->nodeSize;
+                typename block_type::const_span_type *a = block_type::span(p->place(0));
+                f(const_segment(a, a + k));
+                if (k < p->nodeSize) {
+                    a = block_type::span(p->data);
+                    f(const_segment(a, a + p->nodeSize - k));
                 }
-                tmpNode->next->nodeSize = tmpNode->nodeSize - tmpNodePos;
-                tmpNode->nodeSize = tmpNodePos + 1;
-                //if(tmpNode->data[tmpNodePos]) delete tmpNode->data[tmpNodePos];
-                tmpNode->data[tmpNodePos] = new T(value);
-                return pos;
             }
+        }
 
-            for(int i = tmpNode->nodeSize-1;i >= tmpNodePos;i--){
-                tmpNode->data[i+1] = new T(*(tmpNode->data[i]));
-                delete tmpNode->data[i];
-            }
-            tmpNode->nodeSize++;
-            tmpNode->data[tmpNodePos] = new T(value);
-            return pos;*/
+        //inserts elements at the specified location on in the container.
+        //inserts value before pos
+        //returns an iterator pointing to the inserted value
+        //throw if the iterator is invalid or it point to a wrong place.
+        iterator insert(iterator pos, const T &value) {
+            return emplace(pos, value);
+        }
+
+        iterator insert(iterator pos, T &&value) {
+            return emplace(pos, std::move(value));
+        }
+
+        //constructs an element with args before pos.
+        //the element is built before anything is moved, so args may refer to elements of this deque.
+        template<class... Args>
+        iterator emplace(iterator pos, Args &&... args) {
+            checkInsert(pos);
+
+            T value(std::forward<Args>(args)...);
+            relocations = 0;
+            if (pos.currentNode->nodeSize == nodeLength) makeRoom(pos);
+            node *cur = pos.currentNode;
+            unshare(cur);
+            relocations += cur->insert(alloc, pos.nodePos, std::move(value));
+            length++;
+            indexResize(cur, 1);
+            return pos;
         }
 
         //removes specified element at pos.
@@ -728,348 +1705,1098 @@ namespace sjtu {
                 throw invalid_iterator();
             if (empty()) throw container_is_empty();
 
+            node *cur = pos.currentNode;
+            unshare(cur);
+            relocations = cur->erase(alloc, pos.nodePos);
             length--;
-            //if the pos points to the last data, i should know that...
-            T *place;
-            bool isEnd = false;
-            if(pos + 1 == end())
-                isEnd = true;
-            else{
-                //if the pos doesn't point to the last data, so i can use place to find...
-                place = (pos + 1).currentNode->data[(pos + 1).nodePos];
-            }
+            indexResize(cur, -1);
+
+            //if the deque is empty, the only node is kept
+            if (length == 0)
+                return begin();
 
+            //(res, resPos) tracks the element following the erased one while nodes are merged,
+            //res == NULL means the erased element was the last one.
+            node *res = cur;
+            int resPos = pos.nodePos;
+            if (resPos == cur->nodeSize) {
+                res = cur->next;
+                resPos = 0;
+            }
 
-            //if the node is not deleted, this tmp iterator can be used.
-            iterator tmp(pos + 1);
-            delete pos.currentNode->data[pos.nodePos];
-            pos.currentNode->data[pos.nodePos] = NULL;
-            pos.currentNode->nodeSize--;
-            //the nodeSize has been  minus...
-            for (int i = pos.nodePos; i < pos.currentNode->nodeSize; i++) {
-                pos.currentNode->data[i] = pos.currentNode->data[i + 1];
-                pos.currentNode->data[i + 1] = NULL;
+            //if this node is empty, just delete it
+            if (cur->nodeSize == 0) {
+                unlink(cur);
+                return res == NULL ? end() : iterator(this, res, 0);
             }
+            return rebalance(cur, res, resPos);
+        }
 
-            //if the deque is empty
-            if (length == 0)
-                return begin();
-            //if not
+        //removes the elements in [first, last).
+        //returns an iterator pointing to the element last pointed to, end() if last is end().
+        //the nodes fully inside the range are freed as a whole, and the merging is only done
+        //once, around the seam.
+        iterator erase(iterator first, iterator last) {
+            checkInsert(first);
+            checkInsert(last);
+            relocations = 0;
+            if (first == last) return last;
+            if (last - first < 0) throw invalid_iterator();
+
+            node *a = first.currentNode, *b = last.currentNode;
+            int ia = first.nodePos, ib = last.nodePos;
+            if (a == b) eraseIn(a, ia, ib);
             else {
-                //if this node is empty
-                if (pos.currentNode->nodeSize == 0) {
-                    //if this node is also the head, delete this node and put the pointer *head to the next node
-                    if (pos.currentNode == head) {
-                        node *del = head;
-                        head = head->next;
-                        head->prev = NULL;
-                        delete del;
+                eraseIn(a, ia, a->nodeSize);
+                //the nodes in the middle go as a whole, deleteNode() destroys their elements
+                for (node *m = a->next, *n; m != b; m = n) {
+                    n = m->next;
+                    length -= m->nodeSize;
+                    unlink(m);
+                }
+                eraseIn(b, 0, ib);
+            }
+            if (length == 0) {
+                clearAll();
+                return begin();
+            }
 
-                        return begin();
+            //(res, resPos) is the element last pointed to, it follows the erased range now
+            node *res = b;
+            int resPos = 0;
+            if (a == b) resPos = ia;
+            else if (b->nodeSize == 0) {
+                //b is the tail, last is end()
+                unlink(b);
+                res = NULL;
+            }
+            if (res != NULL && resPos == res->nodeSize) {
+                res = res->next;
+                resPos = 0;
+            }
+            if (a->nodeSize == 0) {
+                unlink(a);
+                return res == NULL ? end() : rebalance(res, res, resPos);
+            }
+            return rebalance(a, res, resPos);
+        }
 
-                    }
-                    else{
-                        //if this node is tail, delete this node and put the pointer *tail to the previous node
-                        if(pos.currentNode == tail){
-                            node *del = tail;
-                            tail = tail->prev;
-                            tail->next = NULL;
-                            delete del;
-
-                            return end();
-                        }
-                        //others, delete this node and change its prev-next & next-prev
-                        else{
-                            node *del = pos.currentNode;
-                            del->prev->next = del->next;
-                            del->next->prev = del->prev;
-                            delete del;
+        //inserts copies of the elements in [first, last) before pos.
+        //returns an iterator pointing to the first inserted element, pos if the range is empty.
+        //the new elements are put in full new nodes, which are linked into the list as a whole.
+        template<class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+        iterator insert(iterator pos, InputIt first, InputIt last) {
+            checkInsert(pos);
+            node *cf, *cl;
+            int count = makeChain(rangeSource<InputIt>(first, last), cf, cl);
+            relocations = 0;
+            return insertChain(pos, cf, cl, count);
+        }
 
-                            return tmp;
+        //inserts count copies of value before pos.
+        iterator insert(iterator pos, size_t count, const T &value) {
+            checkInsert(pos);
+            node *cf, *cl;
+            int n = makeChain(fillSource(count, value), cf, cl);
+            relocations = 0;
+            return insertChain(pos, cf, cl, n);
+        }
 
-                        }
-                    }
+        //moves the elements of other in [first, last) before pos, other must be another deque.
+        //with equal allocators the nodes are relinked, only the nodes at the ends of the range
+        //and at pos are split or merged, so it costs O(number of nodes) and no element is copied.
+        //otherwise the elements are moved one by one. the iterators to the moved elements are
+        //invalidated, like the ones to the split and merged nodes.
+        void splice(iterator pos, deque &other, iterator first, iterator last) {
+            checkInsert(pos);
+            if (&other == this) throw invalid_iterator();
+            other.checkInsert(first);
+            other.checkInsert(last);
+            if (last - first < 0) throw invalid_iterator();
+            if (!(alloc == other.alloc)) {
+                insert(pos, std::make_move_iterator(first), std::make_move_iterator(last));
+                other.erase(first, last);
+                return;
+            }
+            //a spare node, so that the split at pos does not need to allocate
+            if (pool == NULL) fillPool(1);
+            node *cf, *cl;
+            int count = other.detach(first, last, cf, cl);
+            try {
+                insertChain(pos, cf, cl, count);
+            } catch (...) {
+                while (cf != NULL) {
+                    node *n = cf->next;
+                    deleteNode(cf);
+                    cf = n;
                 }
+                throw;
+            }
+        }
 
-                //this node is not empty, so consider whether its next and itself can be merged
-                else {
-                    //if this node is tail ,it doesn't have next...but it has prev
-                    if (pos.currentNode == tail){
-                        //if the deque only has one node, nothing should be done.
-                        if(pos.currentNode == head)
-                            return pos;
-                        //else, let's do something
-                        else {
-                            while (pos.currentNode != head && pos.currentNode->nodeSize < nodeLength / 2 &&
-                            pos.currentNode->nodeSize + pos.currentNode->prev->nodeSize < nodeLength) {
-                                    for (int i = 0; i < pos.currentNode->nodeSize; i++) {
-                                        pos.currentNode->prev->data[pos.currentNode->prev->nodeSize + i] = pos.currentNode->data[i];
-                                        pos.currentNode->data[i] = NULL;
-                                    }
-                                    node *del = pos.currentNode;
-                                    pos.currentNode = pos.currentNode->prev;
-                                    pos.currentNode->nodeSize += del->nodeSize;
-                                    pos.currentNode->next = NULL;
-                                    //pos.currentNode->next = del->next;
-                                    //del->next->prev = pos.currentNode;
-                                    delete del;
+        //moves all the elements of other before pos
+        void splice(iterator pos, deque &other) { splice(pos, other, other.begin(), other.end()); }
+
+        void splice(iterator pos, deque &&other) { splice(pos, other, other.begin(), other.end()); }
+
+        //moves the elements of other to the end, see splice()
+        void append(deque &&other) { splice(end(), other, other.begin(), other.end()); }
+
+        //removes the elements in [pos, end()) and returns them as a new deque, see splice()
+        deque split_off(iterator pos) {
+            deque res(alloc);
+            res.splice(res.end(), *this, pos, end());
+            return res;
+        }
+
+        //replaces the contents with the elements in [first, last)
+        template<class InputIt, class = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+        void assign(InputIt first, InputIt last) {
+            node *cf, *cl;
+            int count = makeChain(rangeSource<InputIt>(first, last), cf, cl);
+            clearAll();
+            insertChain(end(), cf, cl, count);
+        }
+
+        //replaces the contents with count copies of value
+        void assign(size_t count, const T &value) {
+            node *cf, *cl;
+            int n = makeChain(fillSource(count, value), cf, cl);
+            clearAll();
+            insertChain(end(), cf, cl, n);
+        }
+
+        //sorts the elements with comp (operator< by default), the iterators are invalidated.
+        //every block is sorted in place, then the sorted runs are merged two by two. a merge
+        //fills new nodes, which are mostly the nodes it has used up, so it needs few extra nodes.
+        //with boxed_storage only the element pointers are sorted, the elements are not moved.
+        void sort() { sortNodes(std::less<T>(), false, 1, inlineRunner()); }
+
+        template<class Compare>
+        void sort(Compare comp) { sortNodes(comp, false, 1, inlineRunner()); }
+
+        //sort() with the work split into parts: run(parts, f) must call f(k) for every k in
+        //[0, parts), on any threads, and return when they are done (see parallel_sort()). the
+        //blocks are sorted by ranges, and the merges of a round are split by ranges of pairs.
+        //with boxed_storage the pointers are sorted by the calling thread.
+        template<class Compare, class Runner>
+        void sort(Compare comp, int parts, Runner run) { sortNodes(comp, false, parts, run); }
+
+        //the same as sort(), but the equal elements keep their order
+        void stable_sort() { sortNodes(std::less<T>(), true, 1, inlineRunner()); }
+
+        template<class Compare>
+        void stable_sort(Compare comp) { sortNodes(comp, true, 1, inlineRunner()); }
+
+    private:
+        //the bytes between the elements of a record and the next record, for save()
+        void writePadding(std::ostream &os, std::uint64_t n) const {
+            static const char zeros[64] = {};
+            for (; n > 64; n -= 64) os.write(zeros, 64);
+            os.write(zeros, (std::streamsize) n);
+        }
+
+        //the elements of p in order, as one or two bulk writes with inline_storage
+        void writeElements(std::ostream &os, const node *p) const {
+            if (!Storage::contiguous) {
+                for (int i = 0; i < p->nodeSize; i++)
+                    os.write(reinterpret_cast<const char *>(p->at(i)), sizeof(T));
+                return;
+            }
+            int k = nodeLength - p->start;
+            if (k > p->nodeSize) k = p->nodeSize;
+            os.write(reinterpret_cast<const char *>(p->at(0)), (std::streamsize) (k * sizeof(T)));
+            if (k < p->nodeSize)
+                os.write(reinterpret_cast<const char *>(p->at(k)), (std::streamsize) ((p->nodeSize - k) * sizeof(T)));
+        }
+
+        //read the records of h from is into a new list cf..cl, returns the number of elements.
+        //with the same block length every record is read straight into the block of a node,
+        //otherwise the elements are copied from a buffer into full nodes.
+        int readChain(std::istream &is, const deque_file::header &h, node *&cf, node *&cl) {
+            const std::uint64_t rest = deque_file::recordBytes(sizeof(T), h.blockLength) - deque_file::blockOffset;
+            const bool direct = Storage::contiguous && h.blockLength == (std::uint64_t) nodeLength;
+            std::vector<char> buffer(direct ? 0 : rest);
+            std::uint64_t count = 0;
+            cf = cl = NULL;
+            try {
+                for (std::uint64_t r = 0; r < h.records; r++) {
+                    char record[deque_file::blockOffset];
+                    std::uint64_t n;
+                    if (!is.read(record, deque_file::blockOffset)) throw runtime_error();
+                    std::memcpy(&n, record, sizeof(n));
+                    if (n == 0 || n > h.blockLength || count + n > h.size) throw runtime_error();
+                    if (direct) {
+                        node *p = newNode(cl, NULL);
+                        if (cl != NULL) cl->next = p;
+                        else cf = p;
+                        cl = p;
+                        std::streamsize bytes = (std::streamsize) (n * sizeof(T));
+                        if (!is.read(reinterpret_cast<char *>(p->data), bytes)) throw runtime_error();
+                        p->nodeSize = (int) n;
+                        std::streamsize pad = (std::streamsize) rest - bytes;
+                        if (is.ignore(pad).gcount() != pad) throw runtime_error();
+                    } else {
+                        if (!is.read(buffer.data(), (std::streamsize) rest)) throw runtime_error();
+                        for (std::uint64_t i = 0; i < n; i++) {
+                            if (cl == NULL || cl->nodeSize == nodeLength) {
+                                node *p = newNode(cl, NULL);
+                                if (cl != NULL) cl->next = p;
+                                else cf = p;
+                                cl = p;
                             }
+                            block_type::construct(alloc, cl->place(cl->nodeSize),
+                                                  *reinterpret_cast<const T *>(buffer.data() + i * sizeof(T)));
+                            cl->nodeSize++;
                         }
-                        if(isEnd) {
-                            tail = pos.currentNode;
-                            return end();
-                        }
-                        else {
-                            tail = pos.currentNode;
-                            iterator search(this, pos.currentNode, 0);
-                            while (search.currentNode->data[search.nodePos] != place)
-                                search++;
+                    }
+                    count += n;
+                }
+                if (count != h.size) throw runtime_error();
+            } catch (...) {
+                while (cf != NULL) {
+                    node *n = cf->next;
+                    deleteNode(cf);
+                    cf = n;
+                }
+                throw;
+            }
+            return (int) count;
+        }
+
+    public:
+        //writes the elements to os in the block aligned format of deque_file, one record per
+        //node, T must be trivially copyable. throws runtime_error if the stream fails.
+        void save(std::ostream &os) const {
+            static_assert(std::is_trivially_copyable<T>::value, "save() needs trivially copyable elements");
+            deque_file::header h;
+            std::memcpy(h.magic, deque_file::magic(), 8);
+            h.elementSize = sizeof(T);
+            h.blockLength = nodeLength;
+            h.size = length;
+            h.records = 0;
+            for (const node *p = head; p != NULL; p = p->next)
+                if (p->nodeSize > 0) h.records++;
+            char header[deque_file::headerBytes];
+            deque_file::writeHeader(header, h);
+            os.write(header, deque_file::headerBytes);
+            const std::uint64_t rest = deque_file::recordBytes(sizeof(T), nodeLength) - deque_file::blockOffset;
+            for (const node *p = head; p != NULL && os; p = p->next) {
+                if (p->nodeSize == 0) continue;
+                char record[deque_file::blockOffset] = {};
+                std::uint64_t n = p->nodeSize;
+                std::memcpy(record, &n, sizeof(n));
+                os.write(record, deque_file::blockOffset);
+                writeElements(os, p);
+                writePadding(os, rest - n * sizeof(T));
+            }
+            if (!os) throw runtime_error();
+        }
+
+        void save(const std::string &path) const {
+            std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+            if (!os) throw runtime_error();
+            save(os);
+            os.close();
+            if (!os) throw runtime_error();
+        }
 
-                            return search;
+        //replaces the contents with the elements written by save(), T must be trivially copyable.
+        //throws runtime_error if the stream fails or does not hold a deque of T, and the deque
+        //is not changed then.
+        void load(std::istream &is) {
+            static_assert(std::is_trivially_copyable<T>::value, "load() needs trivially copyable elements");
+            char header[deque_file::headerBytes];
+            deque_file::header h;
+            if (!is.read(header, deque_file::headerBytes) || !deque_file::readHeader(header, h)
+                || h.elementSize != sizeof(T) || h.size > (std::uint64_t) INT_MAX)
+                throw runtime_error();
+            node *cf, *cl;
+            int count = readChain(is, h, cf, cl);
+            clearAll();
+            insertChain(end(), cf, cl, count);
+        }
+
+        void load(const std::string &path) {
+            std::ifstream is(path.c_str(), std::ios::binary);
+            if (!is) throw runtime_error();
+            load(is);
+        }
+
+    private:
+        //the runner of sort() without threads
+        struct inlineRunner {
+            template<class F>
+            void operator()(int parts, F f) const {
+                for (int k = 0; k < parts; k++) f(k);
+            }
+        };
+
+        template<class Compare, class Runner>
+        void sortNodes(Compare comp, bool stable, int parts, Runner run) {
+            if (length < 2) return;
+            for (node *p = head; p != NULL; p = p->next) unshare(p);
+            if (!Storage::contiguous) {
+                //the deque is only changed once the pointers are sorted
+                std::vector<slot> order;
+                order.reserve(length);
+                for (node *p = head; p != NULL; p = p->next)
+                    for (int i = 0; i < p->nodeSize; i++) order.push_back(*p->place(i));
+                auto less = [&comp](const slot &a, const slot &b) {
+                    return comp(*block_type::get(const_cast<slot *>(&a)), *block_type::get(const_cast<slot *>(&b)));
+                };
+                if (stable) std::stable_sort(order.begin(), order.end(), less);
+                else std::sort(order.begin(), order.end(), less);
+                int k = 0;
+                for (node *p = head; p != NULL; p = p->next)
+                    for (int i = 0; i < p->nodeSize; i++) *p->place(i) = order[k++];
+                return;
+            }
+            if (parts < 1) parts = 1;
+
+            //every block is a sorted run, then the runs are merged two by two.
+            //the parts only touch their own nodes, and an exception is kept until they are done.
+            std::vector<chain> runs;
+            for (node *p = head; p != NULL; p = p->next) {
+                linearize(p);
+                chain c = {p, p};
+                runs.push_back(c);
+            }
+            std::vector<std::exception_ptr> errors(parts);
+            run(parts, [&](int k) {
+                try {
+                    int from = (int) ((long long) runs.size() * k / parts);
+                    int to = (int) ((long long) runs.size() * (k + 1) / parts);
+                    for (int i = from; i < to; i++) {
+                        T *a = runs[i].first->at(0);
+                        if (stable) std::stable_sort(a, a + runs[i].first->nodeSize, comp);
+                        else std::sort(a, a + runs[i].first->nodeSize, comp);
+                    }
+                } catch (...) {
+                    errors[k] = std::current_exception();
+                }
+            });
+            for (int k = 0; k < parts; k++)
+                if (errors[k]) std::rethrow_exception(errors[k]);
+            if (runs.size() == 1) return;
+            for (int i = 0; i < (int) runs.size(); i++) runs[i].first->prev = runs[i].last->next = NULL;
+
+            //a merge reuses the nodes it has used up for the merged run, the few nodes more it
+            //needs come from the pool under lock
+            int limit = poolLimit;
+            poolLimit = INT_MAX;
+            std::mutex lock;
+            while (runs.size() > 1) {
+                int pairs = (int) runs.size() / 2;
+                std::vector<chain> merged(pairs);
+                std::vector<std::exception_ptr> failed(pairs);
+                std::vector<node *> spares(parts, NULL);
+                run(parts, [&](int k) {
+                    for (int i = pairs * k / parts; i < pairs * (k + 1) / parts; i++) {
+                        try {
+                            merged[i] = mergeChains(runs[2 * i], runs[2 * i + 1], comp, spares[k], lock);
+                        } catch (...) {
+                            failed[i] = std::current_exception();
                         }
                     }
-                    //maybe it has chance to be merged ?  backforward and preforward
-                    else {
-                        //the condition that its next is tail is so mess, put it off
-                        //operate these nodes until can't be merged or occur the condition
-                        //this condition we should only backforward merge.
-                        if(pos.currentNode == head) {
-                            while (pos.currentNode->next != tail && pos.currentNode->nodeSize < nodeLength / 2) {
-                                if(pos.currentNode == tail)
-                                    break;
-                                if (pos.currentNode->nodeSize + pos.currentNode->next->nodeSize < nodeLength) {
-                                    for (int i = 0; i < pos.currentNode->next->nodeSize; i++) {
-                                        pos.currentNode->data[pos.currentNode->nodeSize +
-                                                              i] = pos.currentNode->next->data[i];
-                                        pos.currentNode->next->data[i] = NULL;
-                                    }
-                                    node *del = pos.currentNode->next;
-                                    pos.currentNode->nodeSize += del->nodeSize;
-                                    pos.currentNode->next = del->next;
-                                    del->next->prev = pos.currentNode;
-                                    delete del;
-                                    //pos.currentNode = pos.currentNode->next;
-                                }
-                                else {
-                                    break;
-                                }
-                            }
+                });
+                for (int k = 0; k < parts; k++)
+                    for (node *p = spares[k], *n; p != NULL; p = n) {
+                        n = p->next;
+                        deleteNode(p);
+                    }
+                //a failed merge has put all the elements of its two runs in the first one
+                std::vector<chain> next;
+                for (int i = 0; i < pairs; i++) next.push_back(failed[i] ? runs[2 * i] : merged[i]);
+                if (runs.size() % 2 == 1) next.push_back(runs.back());
+                runs.swap(next);
+                for (int i = 0; i < pairs; i++)
+                    if (failed[i]) {
+                        adoptChains(runs, limit);
+                        std::rethrow_exception(failed[i]);
+                    }
+            }
+            adoptChains(runs, limit);
+        }
 
-                            if (pos.currentNode->next == tail &&
-                                pos.currentNode->nodeSize < nodeLength / 2 &&
-                                pos.currentNode->nodeSize + pos.currentNode->next->nodeSize < nodeLength) {
-                                for (int i = 0; i < tail->nodeSize; i++) {
-                                    pos.currentNode->data[pos.currentNode->nodeSize +
-                                                          i] = tail->data[i];
-                                    tail->data[i] = NULL;
-                                }
-                                pos.currentNode->nodeSize += tail->nodeSize;
-                                node *del = tail;
-                                //pos.currentNode->next = NULL;
-                                delete del;
-                                tail = pos.currentNode;
-                                tail->next = NULL;
-                                if (isEnd)
-                                    return end();
-                                else {
-                                    node *cmp = pos.currentNode == head ? pos.currentNode : pos.currentNode->prev;
-                                    iterator search(this, cmp, 0);
-                                    while (search.currentNode->data[search.nodePos] != place)
-                                        search++;
-                                    return search;
-                                }
-                            }
-                            else {
-                                if (isEnd)
-                                    return end();
-                                else {
-                                    node *cmp = pos.currentNode == head ? pos.currentNode : pos.currentNode->prev;
-                                    iterator search(this, cmp, 0);
-                                    while (search.currentNode->data[search.nodePos] != place)
-                                        search++;
-                                    return search;
-                                }
-                                //return pos;
-                            }
-                        }
-                        //not from head, so when next-operation complete, prev-operation start.
-                        else{
-                            while (pos.currentNode->next != tail && pos.currentNode->nodeSize < nodeLength / 2) {
-                                if(pos.currentNode == tail)
-                                    break;
-                                if (pos.currentNode->nodeSize + pos.currentNode->next->nodeSize < nodeLength) {
-                                    for (int i = 0; i < pos.currentNode->next->nodeSize; i++) {
-                                        pos.currentNode->data[pos.currentNode->nodeSize +
-                                                              i] = pos.currentNode->next->data[i];
-                                        pos.currentNode->next->data[i] = NULL;
-                                    }
-                                    node *del = pos.currentNode->next;
-                                    pos.currentNode->nodeSize += del->nodeSize;
-                                    pos.currentNode->next = del->next;
-                                    del->next->prev = pos.currentNode;
-                                    delete del;
-                                    //pos.currentNode = pos.currentNode->next;
-                                }
-                                else {
-                                    break;
-                                }
-                            }
+        //move the elements of p to the front of its block, so that they are a plain array
+        void linearize(node *p) {
+            if (p->start + p->nodeSize <= nodeLength) return;
+            node *tmp = newNode(NULL, NULL);
+            for (int i = 0; i < p->nodeSize; i++)
+                block_type::relocate(alloc, tmp->data + i, p->place(i));
+            std::swap(p->data, tmp->data);
+            std::swap(p->refs, tmp->refs);
+            p->start = 0;
+            deleteNode(tmp);
+        }
 
-                            bool isTail = false;
-
-                            if (pos.currentNode->next == tail &&
-                                pos.currentNode->nodeSize < nodeLength / 2 &&
-                                pos.currentNode->nodeSize + pos.currentNode->next->nodeSize < nodeLength) {
-                                for (int i = 0; i < pos.currentNode->next->nodeSize; i++) {
-                                    pos.currentNode->data[pos.currentNode->nodeSize +
-                                                          i] = pos.currentNode->next->data[i];
-                                    pos.currentNode->next->data[i] = NULL;
-                                }
-                                pos.currentNode->nodeSize += tail->nodeSize;
-                                node *del = tail;
-                                //pos.currentNode->next = NULL;
-                                delete del;
-                                tail = pos.currentNode;
-                                tail->next = NULL;
-                                isTail = true;
-                            }
-                            else {
-                                //return pos;
-                            }
+        //a list of nodes which do not wrap around their blocks, first->prev and last->next are NULL
+        struct chain {
+            node *first, *last;
+        };
 
-                            if(isTail){
-                                while (pos.currentNode != head && pos.currentNode->nodeSize < nodeLength / 2) {
-                                    if (pos.currentNode->nodeSize + pos.currentNode->prev->nodeSize < nodeLength) {
-                                        for (int i = 0; i < pos.currentNode->nodeSize; i++) {
-                                            pos.currentNode->prev->data[pos.currentNode->prev->nodeSize + i] = pos.currentNode->data[i];
-                                            pos.currentNode->data[i] = NULL;
-                                        }
-                                        node *del = pos.currentNode;
-                                        pos.currentNode = pos.currentNode->prev;
-                                        pos.currentNode->nodeSize += del->nodeSize;
-                                        pos.currentNode->next = NULL;
-                                        //pos.currentNode->next = del->next;
-                                        //del->next->prev = pos.currentNode;
-                                        delete del;
-                                    }
-                                    else {
-                                        break;
-                                    }
-                                }
-
-                                tail = pos.currentNode;
-                                if (isEnd)
-                                    return end();
-                                else {
-                                    node *cmp = pos.currentNode == head ? pos.currentNode : pos.currentNode->prev;
-                                    iterator search(this, cmp, 0);
-                                    while (search.currentNode->data[search.nodePos] != place)
-                                        search++;
-                                    return search;
-                                }
-                            }
-                            else{
-                                while (pos.currentNode != head && pos.currentNode->nodeSize < nodeLength / 2) {
-                                    if (pos.currentNode->nodeSize + pos.currentNode->prev->nodeSize < nodeLength) {
-                                        for (int i = 0; i < pos.currentNode->nodeSize; i++) {
-                                            pos.currentNode->prev->data[pos.currentNode->prev->nodeSize + i] = pos.currentNode->data[i];
-                                            pos.currentNode->data[i] = NULL;
-                                        }
-                                        node *del = pos.currentNode;
-                                        pos.currentNode = pos.currentNode->prev;
-                                        pos.currentNode->nodeSize += del->nodeSize;
-                                        //pos.currentNode->next = NULL;
-                                        pos.currentNode->next = del->next;
-                                        del->next->prev = pos.currentNode;
-                                        delete del;
-                                    }
-                                    else {
-                                        break;
-                                    }
-                                }
-
-                                if (isEnd)
-                                    return end();
-                                else {
-                                    node *cmp;
-                                    if (pos.currentNode == head) {
-                                        cmp = pos.currentNode;
-                                    } else {
-                                        cmp = pos.currentNode->prev;
-                                    }
-                                    iterator search(this, cmp, 0);
-                                    while (search.currentNode->data[search.nodePos] != place)
-                                        search++;
-                                    return search;
-                                }
+        //merge the sorted lists a and b into a new list of full nodes, a wins the ties.
+        //the nodes of a and b go to spare as soon as they are used up, and the rest of the list
+        //left over is linked as it is. if comp throws, a is made the list of all the elements.
+        template<class Compare>
+        chain mergeChains(chain &a, chain &b, Compare &comp, node *&spare, std::mutex &lock) {
+            chain res = {NULL, NULL};
+            node *pa = a.first, *pb = b.first;
+            slot *sa = pa->place(0), *sb = pb->place(0), *so = NULL;
+            try {
+                while (pa != NULL && pb != NULL) {
+                    if (res.last == NULL || so == res.last->data + nodeLength) {
+                        node *q = mergeNode(res.last, spare, lock);
+                        if (res.last != NULL) res.last->next = q;
+                        else res.first = q;
+                        res.last = q;
+                        so = q->data;
+                    }
+                    slot *ea = pa->place(0) + pa->nodeSize, *eb = pb->place(0) + pb->nodeSize;
+                    slot *eo = res.last->data + nodeLength;
+                    while (sa != ea && sb != eb && so != eo) {
+                        if (comp(*block_type::get(sb), *block_type::get(sa))) block_type::relocate(alloc, so++, sb++);
+                        else block_type::relocate(alloc, so++, sa++);
+                    }
+                    res.last->nodeSize = (int) (so - res.last->data);
+                    if (sa == ea) pa = usedUp(pa, sa, spare);
+                    if (sb == eb) pb = usedUp(pb, sb, spare);
+                }
+                //the rest of the node left over goes to the last new node if it fits there,
+                //so that the merged list does not get more nodes than it had
+                node *&pr = pa != NULL ? pa : pb;
+                slot *&sr = pa != NULL ? sa : sb;
+                if (pr != NULL && res.last != NULL) {
+                    slot *er = pr->place(0) + pr->nodeSize;
+                    if (er - sr <= res.last->data + nodeLength - so) {
+                        while (sr != er) block_type::relocate(alloc, so++, sr++);
+                        res.last->nodeSize = (int) (so - res.last->data);
+                        pr = usedUp(pr, sr, spare);
+                    }
+                }
+            } catch (...) {
+                if (res.last != NULL && so == res.last->data) {
+                    //the new node is still empty
+                    node *q = res.last;
+                    res.last = q->prev;
+                    if (res.last != NULL) res.last->next = NULL;
+                    else res.first = NULL;
+                    q->next = spare;
+                    spare = q;
+                } else if (res.last != NULL) res.last->nodeSize = (int) (so - res.last->data);
+                appendRest(res, pa, sa, a.last);
+                appendRest(res, pb, sb, b.last);
+                a = res;
+                b.first = b.last = NULL;
+                throw;
+            }
+            appendRest(res, pa, sa, a.last);
+            appendRest(res, pb, sb, b.last);
+            return res;
+        }
 
-                            }
-                        }
+        //link the rest of a list after res, from the element s of p to the node last.
+        //the used part of p is cut off by moving its start.
+        void appendRest(chain &res, node *p, slot *s, node *last) {
+            if (p == NULL) return;
+            int k = (int) (s - p->place(0));
+            p->start += k;
+            p->nodeSize -= k;
+            p->prev = res.last;
+            if (res.last != NULL) res.last->next = p;
+            else res.first = p;
+            res.last = last;
+        }
+
+        //p has been used up by a merge and goes to spare (its elements have been moved away),
+        //returns the next node and points s to its first element
+        node *usedUp(node *p, slot *&s, node *&spare) {
+            node *n = p->next;
+            p->nodeSize = 0;
+            p->next = spare;
+            spare = p;
+            if (n != NULL) s = n->place(0);
+            return n;
+        }
+
+        //an empty node after prev for a merge, a used up one from spare if there is one.
+        //a merge takes at most two nodes more than it has used up, one for each of the two
+        //partly used nodes of a and b.
+        node *mergeNode(node *prev, node *&spare, std::mutex &lock) {
+            if (spare == NULL) {
+                std::lock_guard<std::mutex> guard(lock);
+                return newNode(prev, NULL);
+            }
+            node *res = spare;
+            spare = res->next;
+            res->prev = prev;
+            res->next = NULL;
+            res->start = 0;
+            res->nodeSize = 0;
+            res->index = -1;
+            return res;
+        }
+        //make the lists in runs (in order, some can be empty) the list of the deque after a sort
+        void adoptChains(std::vector<chain> &runs, int limit) {
+            head = tail = NULL;
+            for (int i = 0; i < (int) runs.size(); i++) {
+                if (runs[i].first == NULL) continue;
+                if (tail != NULL) tail->next = runs[i].first;
+                else head = runs[i].first;
+                runs[i].first->prev = tail;
+                tail = runs[i].last;
+            }
+            buildIndex();
+            poolLimit = limit;
+            trimPool(poolLimit);
+        }
+
+        //while cur has less than mergeBelow elements (length / 3 by default), merge it with its
+        //next and then its prev as long as the two nodes have at most mergeMax elements together.
+        //an inner node still below mergeBelow then borrows half the difference from its bigger
+        //neighbour (only if lendMin > 0). (res, resPos) is a position tracked through the
+        //merges and moves, res == NULL means end().
+        iterator rebalance(node *cur, node *res, int resPos) {
+            //consider whether it can be merged with its next...
+            while (cur->next != NULL && cur->nodeSize < mergeBelow
+                   && cur->nodeSize + cur->next->nodeSize <= mergeMax) {
+                if (res == cur->next) {
+                    res = cur;
+                    resPos += cur->nodeSize;
+                }
+                absorbNext(cur);
+                counters.add(event_merges, 1);
+            }
+            //...and then with its prev
+            while (cur->prev != NULL && cur->nodeSize < mergeBelow
+                   && cur->nodeSize + cur->prev->nodeSize <= mergeMax) {
+                node *p = cur->prev;
+                if (res == cur) {
+                    res = p;
+                    resPos += p->nodeSize;
+                }
+                absorbNext(p);
+                counters.add(event_merges, 1);
+                cur = p;
+            }
+
+            //an inner node which is still too small evens out with its bigger neighbour,
+            //the end nodes may be small
+            if (lendMin > 0 && cur->nodeSize < mergeBelow && cur->prev != NULL && cur->next != NULL) {
+                node *p = cur->prev, *n = cur->next;
+                if (n->nodeSize >= p->nodeSize) {
+                    int k = (n->nodeSize - cur->nodeSize) / 2;
+                    if (res == n) {
+                        if (resPos < k) {
+                            res = cur;
+                            resPos += cur->nodeSize;
+                        } else resPos -= k;
                     }
+                    moveAcross(cur, -k);
+                } else {
+                    int k = (p->nodeSize - cur->nodeSize) / 2;
+                    if (res == cur) resPos += k;
+                    else if (res == p && resPos >= p->nodeSize - k) {
+                        res = cur;
+                        resPos -= p->nodeSize - k;
+                    }
+                    moveAcross(p, k);
+                }
+            }
+
+            return res == NULL ? end() : iterator(this, res, resPos);
+        }
 
+        //rebalance the node holding the element at rank if it is below mergeBelow
+        void balanceAt(int rank) {
+            if (rank < 0 || rank >= length) return;
+            node *p;
+            int pos;
+            search(rank, p, pos);
+            if (p->nodeSize < mergeBelow) rebalance(p, p, pos);
+        }
+
+        //remove the elements in [from, to) of p, p stays in the list even if it gets empty
+        void eraseIn(node *p, int from, int to) {
+            if (from == to) return;
+            unshare(p);
+            relocations += p->erase(alloc, from, to);
+            length -= to - from;
+            indexResize(p, from - to);
+        }
+
+        //take the elements in [first, last) out of the list as a list of whole nodes cf..cl,
+        //returns the number of elements. only the nodes at both ends of the range are split,
+        //then the nodes around the gap are merged if they fit in one node or rebalanced
+        //against mergeBelow. the ends of the list are rebalanced by insertChain().
+        int detach(iterator first, iterator last, node *&cf, node *&cl) {
+            int count = last - first;
+            cf = cl = NULL;
+            if (count == 0) return 0;
+            int gap = first - begin();
+            node *spare = count == length ? newNode(NULL, NULL) : NULL;
+            node *a = first.currentNode, *b = last.currentNode;
+            int ia = first.nodePos, ib = last.nodePos;
+            try {
+                if (ia > 0) {
+                    splitAt(a, ia);
+                    if (b == a) {
+                        b = a->next;
+                        ib -= ia;
+                    }
+                    a = a->next;
                 }
+                if (ib > 0 && ib < b->nodeSize) splitAt(b, ib);
+            } catch (...) {
+                if (spare != NULL) deleteNode(spare);
+                throw;
+            }
+            //the first node after the range
+            node *after = ib == 0 ? b : b->next;
+            node *before = a->prev;
+            cf = a;
+            cl = after != NULL ? after->prev : tail;
+            for (node *p = cf; p != cl->next; p = p->next) indexRemove(p);
+            cf->prev = cl->next = NULL;
+            if (before != NULL) before->next = after;
+            else head = after;
+            if (after != NULL) after->prev = before;
+            else tail = before;
+            length -= count;
+            if (spare != NULL) {
+                head = tail = spare;
+                buildIndex();
+            }
+            if (before != NULL && after != NULL && before->nodeSize + after->nodeSize <= nodeLength)
+                absorbNext(before);
+            balanceAt(gap - 1);
+            balanceAt(gap);
+            return count;
+        }
 
+        void checkInsert(const iterator &pos) const {
+            if (pos.que != this) throw invalid_iterator();
+            if (pos.currentNode == NULL) throw invalid_iterator();
+            if (pos.currentNode == tail && (pos.nodePos > pos.currentNode->nodeSize
+                                            || pos.nodePos < 0))
+                throw invalid_iterator();
+            if (pos.currentNode != tail && (pos.nodePos >= pos.currentNode->nodeSize
+                                            || pos.nodePos < 0))
+                throw invalid_iterator();
+        }
+
+        //the sources of the elements of makeChain()
+        template<class InputIt>
+        struct rangeSource {
+            InputIt first, last;
+
+            rangeSource(InputIt f, InputIt l) : first(f), last(l) {}
+
+            bool done() const { return first == last; }
+
+            void construct(Allocator &a, slot *s) {
+                block_type::construct(a, s, *first);
+                ++first;
+            }
+        };
+
+        struct fillSource {
+            size_t count;
+            const T &value;
+
+            fillSource(size_t n, const T &v) : count(n), value(v) {}
+
+            bool done() const { return count == 0; }
+
+            void construct(Allocator &a, slot *s) {
+                block_type::construct(a, s, value);
+                count--;
+            }
+        };
+
+        //build a list of full nodes (the last one may be partly filled) from src,
+        //returns the number of elements. nothing is left behind if an element throws.
+        template<class Source>
+        int makeChain(Source src, node *&cf, node *&cl) {
+            cf = cl = NULL;
+            int count = 0;
+            try {
+                while (!src.done()) {
+                    if (cl == NULL || cl->nodeSize == nodeLength) {
+                        node *p = newNode(cl, NULL);
+                        if (cl != NULL) cl->next = p;
+                        else cf = p;
+                        cl = p;
+                    }
+                    src.construct(alloc, cl->place(cl->nodeSize));
+                    cl->nodeSize++;
+                    count++;
+                }
+            } catch (...) {
+                while (cf != NULL) {
+                    node *n = cf->next;
+                    deleteNode(cf);
+                    cf = n;
+                }
+                throw;
             }
+            return count;
         }
 
+        //link the list cf..cl of count elements before pos, then merge the nodes at both seams
+        //if they fit in one node, a seam node which is still below mergeBelow is merged or
+        //evened out with a neighbour as in erase. returns an iterator pointing to the first
+        //element of the list.
+        iterator insertChain(iterator pos, node *cf, node *cl, int count) {
+            if (count == 0) return pos;
+            if (length == 0) {
+                //the only node is empty, replace it
+                node *old = head;
+                head = cf;
+                tail = cl;
+                try {
+                    buildIndex();
+                } catch (...) {
+                    head = tail = old;
+                    while (cf != NULL) {
+                        node *n = cf->next;
+                        deleteNode(cf);
+                        cf = n;
+                    }
+                    throw;
+                }
+                deleteNode(old);
+                length = count;
+                return begin();
+            }
+
+            node *cur = pos.currentNode;
+            node *before, *after;
+            if (pos.nodePos == 0) {
+                before = cur->prev;
+                after = cur;
+            } else if (pos.nodePos == cur->nodeSize) {
+                before = cur;
+                after = cur->next;
+            } else {
+                splitAt(cur, pos.nodePos);
+                before = cur;
+                after = cur->next;
+            }
+
+            int k = 0;
+            for (node *p = cf; p != NULL; p = p->next) k++;
+            int s = freeSlots(before, k);
+            if (before != NULL) before->next = cf;
+            else head = cf;
+            cf->prev = before;
+            cl->next = after;
+            if (after != NULL) after->prev = cl;
+            else tail = cl;
+            for (node *p = cf; p != after; p = p->next) indexLink(p, s++);
+            length += count;
+
+            node *res = cf;
+            int resPos = 0;
+            if (before != NULL && before->nodeSize + cf->nodeSize <= nodeLength) {
+                res = before;
+                resPos = before->nodeSize;
+                absorbNext(before);
+            }
+            if (after != NULL && after->prev->nodeSize + after->nodeSize <= nodeLength)
+                absorbNext(after->prev);
+            //the nodes around both seams, by rank since rebalance() can delete nodes
+            int first = (int) startRank(res) + resPos;
+            balanceAt(first - 1);
+            balanceAt(first);
+            balanceAt(first + count - 1);
+            balanceAt(first + count);
+            search(first, res, resPos);
+            return iterator(this, res, resPos);
+        }
+
+    public:
+
+        //the operations at both ends only touch head or tail. a full end node gets a new
+        //empty node next to it instead of being split, and an end node is deleted as soon
+        //as it is empty (no merging).
+
         // adds an element to the end
-        void push_back(const T &value) {
-            insert(end(), value);
+        void push_back(const T &value) { emplace_back(value); }
+
+        void push_back(T &&value) { emplace_back(std::move(value)); }
+
+        //constructs an element with args at the end
+        template<class... Args>
+        void emplace_back(Args &&... args) {
+            revive();
+            if (tail->nodeSize == nodeLength) {
+                int s = freeSlots(tail, 1);
+                tail = tail->next = newNode(tail, NULL);
+                indexLink(tail, s);
+                if (reservedBack > 0) reservedBack--;
+            } else unshare(tail);
+            block_type::construct(alloc, tail->place(tail->nodeSize), std::forward<Args>(args)...);
+            tail->nodeSize++;
+            length++;
+            indexResize(tail, 1);
         }
 
         //removes the last element
         //throw when the container is empty.
         void pop_back() {
-            erase(end()-1);
+            if (length == 0) throw container_is_empty();
+            unshare(tail);
+            tail->nodeSize--;
+            block_type::destroy(alloc, tail->place(tail->nodeSize));
+            length--;
+            indexResize(tail, -1);
+            if (tail->nodeSize == 0 && tail != head) unlink(tail);
         }
 
         //inserts an element to the beginning.
-        void push_front(const T &value) {
-            insert(begin(), value);
+        void push_front(const T &value) { emplace_front(value); }
+
+        void push_front(T &&value) { emplace_front(std::move(value)); }
+
+        //constructs an element with args at the beginning
+        template<class... Args>
+        void emplace_front(Args &&... args) {
+            revive();
+            if (head->nodeSize == nodeLength) {
+                int s = freeSlots(NULL, 1);
+                head = head->prev = newNode(NULL, head);
+                indexLink(head, s);
+                if (reservedFront > 0) reservedFront--;
+            } else unshare(head);
+            int pos = (head->start == 0 ? nodeLength : head->start) - 1;
+            block_type::construct(alloc, head->data + pos, std::forward<Args>(args)...);
+            head->start = pos;
+            head->nodeSize++;
+            length++;
+            indexResize(head, 1);
         }
 
         //removes the first element.
         //throw when the container is empty.
         void pop_front() {
-            erase(begin());
+            if (length == 0) throw container_is_empty();
+            unshare(head);
+            block_type::destroy(alloc, head->place(0));
+            head->start = (head->start + 1 == nodeLength ? 0 : head->start + 1);
+            head->nodeSize--;
+            length--;
+            indexResize(head, -1);
+            if (head->nodeSize == 0 && head != tail) unlink(head);
         }
 
 
 
-        void split(node *pos) {
-            if (pos == tail) {
-                tail = tail->next = new node(nodeLength, tail, NULL);
-                for (int i = 0; i < nodeLength / 2; i++) {
-                    tail->data[i] = pos->data[nodeLength / 2 + i];
-                    pos->data[nodeLength / 2 + i] = NULL;
+        //make room for an insert at pos, whose node is full. pos is moved to the place of the
+        //new element, which is in a node with room then.
+        //at the end of the tail a new empty tail is opened, and in front of a node the element
+        //goes to the end of the previous one (or a new head) if it has room. otherwise the node
+        //lends elements to the neighbour with the most free slots, if it has at least lendMin
+        //of them, or it is split.
+        void makeRoom(iterator &pos) {
+            node *cur = pos.currentNode, *p = cur->prev, *n = cur->next;
+            if (pos.nodePos == nodeLength) {
+                int s = freeSlots(tail, 1);
+                tail = tail->next = newNode(tail, NULL);
+                indexLink(tail, s);
+                pos.currentNode = tail;
+                pos.nodePos = 0;
+                return;
+            }
+            if (pos.nodePos == 0 && (p == NULL || p->nodeSize < nodeLength)) {
+                if (p == NULL) {
+                    int s = freeSlots(NULL, 1);
+                    head = head->prev = newNode(NULL, head);
+                    indexLink(head, s);
+                    p = head;
                 }
-                pos->nodeSize = nodeLength / 2;
-                tail->nodeSize = nodeLength / 2;
-            } else if (pos == head) {
-                pos->next = new node(nodeLength, pos, pos->next);
-                node *tmp = pos->next;
-                for (int i = 0; i < nodeLength / 2; i++) {
-                    tmp->data[i] = pos->data[i + nodeLength / 2];
-                    pos->data[i + nodeLength / 2] = NULL;
+                pos.currentNode = p;
+                pos.nodePos = p->nodeSize;
+                return;
+            }
+            int roomPrev = p == NULL ? 0 : nodeLength - p->nodeSize;
+            int roomNext = n == NULL ? 0 : nodeLength - n->nodeSize;
+            if (lendMin > 0 && roomNext >= lendMin && roomNext >= roomPrev) {
+                //half of the free slots, so that the neighbour still has room after the insert
+                int k = (roomNext + 1) / 2;
+                moveAcross(cur, k);
+                if (pos.nodePos > nodeLength - k) {
+                    pos.currentNode = n;
+                    pos.nodePos -= nodeLength - k;
                 }
-                tmp->nodeSize = nodeLength / 2;
-                pos->nodeSize = nodeLength / 2;
-                tmp->next->prev = tmp;
+            } else if (lendMin > 0 && roomPrev >= lendMin) {
+                int k = (roomPrev + 1) / 2;
+                if (pos.nodePos < k) {
+                    pos.currentNode = p;
+                    pos.nodePos += p->nodeSize;
+                } else pos.nodePos -= k;
+                moveAcross(p, -k);
             } else {
-                pos->next = new node(nodeLength, pos, pos->next);
-                node *tmp = pos->next;
-                for (int i = 0; i < nodeLength / 2; i++) {
-                    tmp->data[i] = pos->data[i + nodeLength / 2];
-                    pos->data[i + nodeLength / 2] = NULL;
+                split(cur);
+                //the second half has been moved to the new node
+                if (pos.nodePos >= splitPoint) {
+                    pos.currentNode = cur->next;
+                    pos.nodePos -= splitPoint;
                 }
-                tmp->next->prev = tmp;
-                tmp->nodeSize = nodeLength / 2;
-                pos->nodeSize = nodeLength / 2;
             }
         }
 
+        //move k elements from the end of p to the front of p->next, or -k elements from the
+        //front of p->next to the end of p if k < 0. the receiving node must have room.
+        void moveAcross(node *p, int k) {
+            node *n = p->next;
+            unshare(p);
+            unshare(n);
+            for (int i = 0; i < k; i++) {
+                n->start = (n->start == 0 ? nodeLength : n->start) - 1;
+                block_type::relocate(alloc, n->data + n->start, p->place(p->nodeSize - 1));
+                p->nodeSize--;
+                n->nodeSize++;
+            }
+            relocations += k < 0 ? -k : k;
+            for (int i = 0; i > k; i--) {
+                block_type::relocate(alloc, p->place(p->nodeSize), n->place(0));
+                n->start = (n->start + 1 == nodeLength ? 0 : n->start + 1);
+                p->nodeSize++;
+                n->nodeSize--;
+            }
+            indexResize(p, -k);
+            indexResize(n, k);
+            counters.add(event_redistributions, 1);
+        }
+
+        //move the elements of a full node from splitPoint to a new node after it
+        void split(node *pos) {
+            splitAt(pos, splitPoint);
+        }
+
+        //move the elements from the position k of pos to a new node after it
+        void splitAt(node *pos, int k) {
+            counters.add(event_splits, 1);
+            unshare(pos);
+            int s = freeSlots(pos, 1);
+            node *tmp = newNode(pos, pos->next);
+            for (int i = 0; i < pos->nodeSize - k; i++)
+                block_type::relocate(alloc, tmp->place(i), pos->place(k + i));
+            relocations += pos->nodeSize - k;
+            tmp->nodeSize = pos->nodeSize - k;
+            pos->nodeSize = k;
+            if (pos->next) pos->next->prev = tmp;
+            else tail = tmp;
+            pos->next = tmp;
+            indexResize(pos, -tmp->nodeSize);
+            indexLink(tmp, s);
+        }
+
+    private:
+        //exchange the node lists (and their index) with other
+        void swapNodes(deque &other) {
+            std::swap(head, other.head);
+            std::swap(tail, other.tail);
+            std::swap(length, other.length);
+            slots.swap(other.slots);
+            sizes.swap(other.sizes);
+            tree.swap(other.tree);
+        }
+
+        //free every node, including the ones in the pool
+        void destroyAll() {
+            releaseNodes();
+            reservedBack = reservedFront = 0;
+            trimPool(0);
+        }
+
+        //append copies of all the elements of other, this deque must be empty.
+        //with copyOnWrite the blocks of other are shared instead.
+        void copyFrom(const deque &other) {
+            if (other.length == 0) return;
+            revive();
+            if (copyOnWrite && alloc == other.alloc) {
+                shareFrom(other);
+                return;
+            }
+            node *p = head;
+            for (node *q = other.head; q != NULL; q = q->next) {
+                if (p != head || p->nodeSize != 0) {
+                    int s = freeSlots(p, 1);
+                    p = p->next = newNode(p, NULL);
+                    tail = p;
+                    indexLink(p, s);
+                }
+                try {
+                    for (int i = 0; i < q->nodeSize; i++) {
+                        block_type::construct(alloc, p->place(i), *(q->at(i)));
+                        p->nodeSize++;
+                        length++;
+                    }
+                } catch (...) {
+                    indexResize(p, p->nodeSize);
+                    throw;
+                }
+                indexResize(p, p->nodeSize);
+            }
+        }
+
+        //replace the only (empty) node with nodes sharing the blocks of other
+        void shareFrom(const deque &other) {
+            node_allocator na(alloc);
+            node *cf = NULL, *cl = NULL;
+            try {
+                for (node *q = other.head; q != NULL; q = q->next) {
+                    node *p = node_traits::allocate(na, 1);
+                    p->prev = cl;
+                    p->next = NULL;
+                    p->data = q->data;
+                    p->refs = q->refs;
+                    p->refs->count.fetch_add(1, std::memory_order_relaxed);
+                    p->start = q->start;
+                    p->nodeSize = q->nodeSize;
+                    p->index = -1;
+                    if (cl != NULL) cl->next = p;
+                    else cf = p;
+                    cl = p;
+                }
+            } catch (...) {
+                while (cf != NULL) {
+                    node *n = cf->next;
+                    deleteNode(cf);
+                    cf = n;
+                }
+                throw;
+            }
+            node *old = head;
+            head = cf;
+            tail = cl;
+            try {
+                buildIndex();
+            } catch (...) {
+                head = tail = old;
+                while (cf != NULL) {
+                    node *n = cf->next;
+                    deleteNode(cf);
+                    cf = n;
+                }
+                throw;
+            }
+            deleteNode(old);
+            length = other.length;
+        }
 
     };
+
+    template<class T, class Storage, class Allocator, int BlockLength, class BlockPolicy>
+    void swap(deque<T, Storage, Allocator, BlockLength, BlockPolicy> &a,
+              deque<T, Storage, Allocator, BlockLength, BlockPolicy> &b) {
+        a.swap(b);
+    }
 }
 
+#undef SJTU_DEQUE_CHECK
+
 #endif
@@ -0,0 +1,126 @@
+#ifndef SJTU_HAZARD_POINTERS_HPP
+#define SJTU_HAZARD_POINTERS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace sjtu {
+
+    //hazard pointers for the lock-free containers, the nodes are allocated with new.
+    //a thread takes one of the records for the time of an operation (see guard), publishes
+    //the nodes it is reading in it, and the retired nodes are only deleted when no record
+    //points to them. at most n threads can hold a record at the same time, the others wait.
+    template<class Node>
+    class hazard_pointers {
+    public:
+        static const int slots = 2;   //the number of nodes a thread can protect at the same time
+
+    private:
+        struct record {
+            std::atomic<Node *> hazard[slots];
+            std::atomic<bool> active;
+            std::vector<Node *> retired;  //only used by the thread holding the record
+            char pad[64];   //keep the records in different cache lines
+
+            record() : active(false) {
+                for (int i = 0; i < slots; i++) hazard[i].store(NULL, std::memory_order_relaxed);
+            }
+        };
+
+        record *records;
+        int count;
+
+        //delete the nodes of r->retired which are not protected by any record
+        void scan(record *r) {
+            std::vector<Node *> busy;
+            for (int i = 0; i < count; i++)
+                for (int j = 0; j < slots; j++) {
+                    Node *p = records[i].hazard[j].load();
+                    if (p != NULL) busy.push_back(p);
+                }
+            std::sort(busy.begin(), busy.end());
+            std::vector<Node *> keep;
+            for (int i = 0; i < (int) r->retired.size(); i++) {
+                Node *p = r->retired[i];
+                if (std::binary_search(busy.begin(), busy.end(), p)) keep.push_back(p);
+                else delete p;
+            }
+            r->retired.swap(keep);
+        }
+
+    public:
+        explicit hazard_pointers(int n) : count(n) {
+            records = new record[n];
+        }
+
+        hazard_pointers(const hazard_pointers &) = delete;
+
+        hazard_pointers &operator=(const hazard_pointers &) = delete;
+
+        //no thread may be using the records any more
+        ~hazard_pointers() {
+            for (int i = 0; i < count; i++)
+                for (int j = 0; j < (int) records[i].retired.size(); j++)
+                    delete records[i].retired[j];
+            delete[] records;
+        }
+
+        //holds a record while it is alive, all of its hazard pointers are cleared at the end
+        class guard {
+        private:
+            hazard_pointers *hp;
+            record *r;
+
+        public:
+            explicit guard(hazard_pointers &h) : hp(&h) {
+                //start from a slot that depends on the thread, so that the threads rarely meet
+                static thread_local int hint = (int) (std::hash<std::thread::id>()(std::this_thread::get_id()) >> 4);
+                for (int i = (hint % hp->count + hp->count) % hp->count;; i = (i + 1 == hp->count ? 0 : i + 1)) {
+                    bool expected = false;
+                    if (!hp->records[i].active.load(std::memory_order_relaxed)
+                        && hp->records[i].active.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                        r = hp->records + i;
+                        hint = i;
+                        break;
+                    }
+                }
+            }
+
+            guard(const guard &) = delete;
+
+            guard &operator=(const guard &) = delete;
+
+            ~guard() {
+                for (int i = 0; i < slots; i++) r->hazard[i].store(NULL, std::memory_order_release);
+                r->active.store(false, std::memory_order_release);
+            }
+
+            //read src and publish it in the slot k, the result can be used until the slot
+            //is changed or the guard is destroyed
+            Node *protect(int k, const std::atomic<Node *> &src) {
+                Node *p = src.load();
+                while (true) {
+                    r->hazard[k].store(p);
+                    Node *q = src.load();
+                    if (q == p) return p;
+                    p = q;
+                }
+            }
+
+            void clear(int k) {
+                r->hazard[k].store(NULL, std::memory_order_release);
+            }
+
+            //p has been taken out of the structure, delete it once nobody is reading it
+            void retire(Node *p) {
+                r->retired.push_back(p);
+                if ((int) r->retired.size() >= 2 * slots * hp->count + 16) hp->scan(r);
+            }
+        };
+    };
+}
+
+#endif
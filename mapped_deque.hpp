@@ -0,0 +1,146 @@
+#ifndef SJTU_MAPPED_DEQUE_HPP
+#define SJTU_MAPPED_DEQUE_HPP
+
+#include "deque.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sjtu {
+
+    //a read-only view of a file written by deque::save(), mapped into memory (POSIX mmap)
+    //instead of being read. the elements are used in place: opening the file only reads the
+    //header of every record, and block(i) hands out the elements of the node i of the saved
+    //deque without copying them. the file must not be changed while it is mapped.
+    template<class T>
+    class mapped_deque {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value, "the elements must be trivially copyable");
+        static_assert(alignof(T) <= 64, "the elements of a record are only aligned to 64 bytes");
+
+        typedef T value_type;
+        typedef size_t size_type;
+        typedef const T &const_reference;
+        typedef typename deque<T>::const_segment segment;
+
+    private:
+        const char *base;   //the mapped file, NULL after a move
+        size_t bytes;
+        std::vector<const T *> blocks;  //the first element of every record
+        std::vector<long long> ends;    //the rank after the last element of every record
+
+        //check the header and find the records, throw runtime_error if the file is broken
+        void index() {
+            deque_file::header h;
+            if (!deque_file::readHeader(base, h) || h.elementSize != sizeof(T)) throw runtime_error();
+            const std::uint64_t record = deque_file::recordBytes(sizeof(T), h.blockLength);
+            if (h.records > (bytes - deque_file::headerBytes) / record) throw runtime_error();
+            long long end = 0;
+            for (std::uint64_t r = 0; r < h.records; r++) {
+                const char *p = base + deque_file::headerBytes + r * record;
+                std::uint64_t n;
+                std::memcpy(&n, p, sizeof(n));
+                if (n == 0 || n > h.blockLength) throw runtime_error();
+                end += n;
+                blocks.push_back(reinterpret_cast<const T *>(p + deque_file::blockOffset));
+                ends.push_back(end);
+            }
+            if ((std::uint64_t) end != h.size) throw runtime_error();
+        }
+
+        void unmap() {
+            if (base != NULL) ::munmap(const_cast<char *>(base), bytes);
+            base = NULL;
+        }
+
+    public:
+        //map the file at path, throws runtime_error if it can not be mapped or is not a deque of T
+        explicit mapped_deque(const std::string &path) : base(NULL), bytes(0) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) throw runtime_error();
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size < deque_file::headerBytes) {
+                ::close(fd);
+                throw runtime_error();
+            }
+            bytes = st.st_size;
+            void *p = ::mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) throw runtime_error();
+            base = static_cast<const char *>(p);
+            try {
+                index();
+            } catch (...) {
+                unmap();
+                throw;
+            }
+        }
+
+        mapped_deque(const mapped_deque &) = delete;
+
+        mapped_deque &operator=(const mapped_deque &) = delete;
+
+        mapped_deque(mapped_deque &&other)
+                : base(other.base), bytes(other.bytes), blocks(std::move(other.blocks)), ends(std::move(other.ends)) {
+            other.base = NULL;
+            other.blocks.clear();
+            other.ends.clear();
+        }
+
+        ~mapped_deque() { unmap(); }
+
+        //returns the number of elements
+        size_t size() const { return ends.empty() ? 0 : ends.back(); }
+
+        bool empty() const { return size() == 0; }
+
+        //the number of records (the nodes of the saved deque)
+        size_t block_count() const { return blocks.size(); }
+
+        //the elements of the record i, in the mapped file
+        segment block(size_t i) const {
+            if (i >= blocks.size()) throw index_out_of_bound();
+            long long from = i == 0 ? 0 : ends[i - 1];
+            return segment(blocks[i], blocks[i] + (ends[i] - from));
+        }
+
+        //call f(segment) for every record in order
+        template<class F>
+        void for_each_segment(F f) const {
+            for (size_t i = 0; i < blocks.size(); i++) f(block(i));
+        }
+
+        //access specified element with bounds checking
+        //throw index_out_of_bound if out of bound.
+        const T &at(const size_t &pos) const {
+            if (pos >= size()) throw index_out_of_bound();
+            size_t i = std::upper_bound(ends.begin(), ends.end(), (long long) pos) - ends.begin();
+            long long from = i == 0 ? 0 : ends[i - 1];
+            return blocks[i][pos - from];
+        }
+
+        const T &operator[](const size_t &pos) const { return at(pos); }
+
+        //throw container_is_empty when the container is empty
+        const T &front() const {
+            if (empty()) throw container_is_empty();
+            return blocks.front()[0];
+        }
+
+        const T &back() const {
+            if (empty()) throw container_is_empty();
+            return *(block(blocks.size() - 1).end() - 1);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef SJTU_PARALLEL_ALGORITHM_HPP
+#define SJTU_PARALLEL_ALGORITHM_HPP
+
+#include "deque.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace sjtu {
+
+    //whole-deque algorithms that split the elements into one range of ranks per thread.
+    //the starts of the ranges are found on the calling thread, then each thread walks its range
+    //block by block.
+    //threads == 0 means std::thread::hardware_concurrency(), and small deques are done on the
+    //calling thread. an exception thrown by the function on any thread is thrown again by the
+    //call after all the threads have stopped. the deque must not be changed during the call.
+    namespace detail {
+        //the ranges of less than this number of elements are not split
+        const long long parallelGrain = 1 << 14;
+
+        inline int threadCount(int threads, long long n) {
+            if (threads <= 0) threads = (int) std::thread::hardware_concurrency();
+            if (threads <= 0) threads = 1;
+            long long most = (n + parallelGrain - 1) / parallelGrain;
+            if (most < 1) most = 1;
+            return (int) std::min<long long>(threads, most);
+        }
+
+        //call f(k, from, to) for the parts k of [0, n) on parts threads, the calling thread does part 0
+        template<class F>
+        void runParts(long long n, int parts, F f) {
+            std::vector<std::exception_ptr> errors(parts);
+            std::vector<std::thread> threads;
+            for (int k = 1; k < parts; k++)
+                threads.emplace_back([&f, &errors, k, n, parts] {
+                    try {
+                        f(k, n * k / parts, n * (k + 1) / parts);
+                    } catch (...) {
+                        errors[k] = std::current_exception();
+                    }
+                });
+            try {
+                f(0, 0, n / parts);
+            } catch (...) {
+                errors[0] = std::current_exception();
+            }
+            for (int i = 0; i < (int) threads.size(); i++) threads[i].join();
+            for (int k = 0; k < parts; k++)
+                if (errors[k]) std::rethrow_exception(errors[k]);
+        }
+
+        //the iterators to the first elements of the parts of [first, first + n)
+        template<class It>
+        std::vector<It> partStarts(It first, long long n, int parts) {
+            std::vector<It> res;
+            for (int k = 0; k < parts; k++) res.push_back(first + (int) (n * k / parts));
+            return res;
+        }
+
+        //call f(p, k) for the contiguous runs of the n elements from first. the iterator is
+        //stepped with ++, which only reads the nodes, so the threads share nothing in the deque.
+        template<class It, class F>
+        void forSegments(It first, long long n, F f) {
+            while (n > 0) {
+                int k = first.segment_size();
+                if (k > n) k = (int) n;
+                f(std::addressof(*first), k);
+                for (int i = 0; i < k; i++) ++first;
+                n -= k;
+            }
+        }
+
+        //the runner of deque::sort(), f(k) is called for each part k on its own thread
+        struct partRunner {
+            template<class F>
+            void operator()(int parts, F f) const {
+                runParts(parts, parts, [&f](int k, long long, long long) { f(k); });
+            }
+        };
+
+        //with copy-on-write blocks every block gets its own copy before the threads start
+        //writing, as copying a block is not thread-safe
+        template<class Deque>
+        void prepareWrite(Deque &d) {
+            if (Deque::copyOnWrite) d.for_each_segment([](typename Deque::segment) {});
+        }
+
+        template<class Deque>
+        void prepareWrite(const Deque &) {}
+    }
+
+    //call f(x) for every element x of d
+    template<class Deque, class F>
+    void parallel_for_each(Deque &d, F f, int threads = 0) {
+        long long n = d.size();
+        if (n == 0) return;
+        detail::prepareWrite(d);
+        int parts = detail::threadCount(threads, n);
+        auto starts = detail::partStarts(d.begin(), n, parts);
+        detail::runParts(n, parts, [&starts, &f](int k, long long from, long long to) {
+            detail::forSegments(starts[k], to - from, [&f](decltype(std::addressof(*starts[k])) p, int m) {
+                for (int i = 0; i < m; i++) f(p[i]);
+            });
+        });
+    }
+
+    //dst[i] = op(src[i]) for every rank i of src, dst must have at least as many elements.
+    //src and dst can be the same deque.
+    template<class Src, class Dst, class F>
+    void parallel_transform(const Src &src, Dst &dst, F op, int threads = 0) {
+        long long n = src.size();
+        if ((long long) dst.size() < n) throw index_out_of_bound();
+        if (n == 0) return;
+        detail::prepareWrite(dst);
+        int parts = detail::threadCount(threads, n);
+        auto in = detail::partStarts(src.cbegin(), n, parts);
+        auto outs = detail::partStarts(dst.begin(), n, parts);
+        detail::runParts(n, parts, [&in, &outs, &op](int k, long long from, long long to) {
+            typename Dst::iterator out = outs[k];
+            detail::forSegments(in[k], to - from, [&out, &op](const typename Src::value_type *p, int m) {
+                for (int i = 0; i < m; i++, ++out) *out = op(p[i]);
+            });
+        });
+    }
+
+    //op(...op(op(init, x0), x1)..., xn-1) with the elements regrouped, op must be associative
+    template<class Deque, class R, class Op>
+    R parallel_reduce(const Deque &d, R init, Op op, int threads = 0) {
+        long long n = d.size();
+        if (n == 0) return init;
+        int parts = detail::threadCount(threads, n);
+        //the partial result of a part starts with its first element, so no identity is needed
+        std::vector<R> partial(parts, init);
+        auto starts = detail::partStarts(d.cbegin(), n, parts);
+        detail::runParts(n, parts, [&starts, &op, &partial](int k, long long from, long long to) {
+            bool started = false;
+            R acc = partial[k];
+            detail::forSegments(starts[k], to - from, [&](const typename Deque::value_type *p, int m) {
+                int i = 0;
+                if (!started) {
+                    acc = p[0];
+                    started = true;
+                    i = 1;
+                }
+                for (; i < m; i++) acc = op(acc, p[i]);
+            });
+            partial[k] = acc;
+        });
+        for (int k = 0; k < parts; k++) init = op(init, partial[k]);
+        return init;
+    }
+
+    //the sum of init and the elements
+    template<class Deque, class R>
+    R parallel_reduce(const Deque &d, R init) {
+        return parallel_reduce(d, init, std::plus<R>());
+    }
+
+    //the number of elements x of d with pred(x)
+    template<class Deque, class Pred>
+    size_t parallel_count_if(const Deque &d, Pred pred, int threads = 0) {
+        long long n = d.size();
+        if (n == 0) return 0;
+        int parts = detail::threadCount(threads, n);
+        std::vector<size_t> counts(parts, 0);
+        auto starts = detail::partStarts(d.cbegin(), n, parts);
+        detail::runParts(n, parts, [&starts, &pred, &counts](int k, long long from, long long to) {
+            size_t c = 0;
+            detail::forSegments(starts[k], to - from, [&](const typename Deque::value_type *p, int m) {
+                for (int i = 0; i < m; i++)
+                    if (pred(p[i])) c++;
+            });
+            counts[k] = c;
+        });
+        size_t res = 0;
+        for (int k = 0; k < parts; k++) res += counts[k];
+        return res;
+    }
+
+    //sort d with comp in place: the blocks are sorted by the threads, then the runs of nodes
+    //are merged two by two, with the merges of a round split among the threads (see deque::sort()).
+    //the sort is not stable.
+    template<class Deque, class Comp>
+    void parallel_sort(Deque &d, Comp comp, int threads = 0) {
+        if (d.size() < 2) return;
+        d.sort(comp, detail::threadCount(threads, d.size()), detail::partRunner());
+    }
+
+    template<class Deque>
+    void parallel_sort(Deque &d, int threads = 0) {
+        parallel_sort(d, std::less<typename Deque::value_type>(), threads);
+    }
+}
+
+#endif
@@ -0,0 +1,87 @@
+//stress test of concurrent_deque: several producers and consumers at once, every consumer
+//must get the elements of each producer in the order they were pushed, and every element
+//must be popped exactly once. the elements are strings, so that a sanitizer sees their memory.
+//build it with -fsanitize=thread or -fsanitize=address (cmake -DSJTU_SANITIZE=thread) to check
+//the block hand-over and the reclamation of the used up blocks.
+//build: g++ -std=c++14 -O1 -g -fsanitize=thread -pthread -I.. concurrent_deque_stress.cpp
+
+#include "concurrent_deque.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    std::atomic<int> failures(0);
+
+    void fail(const char *what, int producers, int consumers, int length) {
+        if (failures++ < 10)
+            std::printf("%s (block length %d, %d producers, %d consumers)\n", what, length, producers, consumers);
+    }
+
+    template<int Length>
+    void run(int producers, int consumers, int items) {
+        sjtu::concurrent_deque<std::string, Length> q(producers + consumers);
+        std::atomic<int> popped(0);
+        //what each consumer got, in order, as producer * items + sequence number
+        std::vector<std::vector<long long> > got(consumers);
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++)
+            threads.emplace_back([&q, p, items] {
+                for (int i = 0; i < items; i++) q.push_back(std::to_string(p) + ":" + std::to_string(i));
+            });
+        for (int c = 0; c < consumers; c++)
+            threads.emplace_back([&, c] {
+                std::vector<int> last(producers, -1);
+                std::string s;
+                while (popped.load() < producers * items) {
+                    if (!q.try_pop_front(s)) continue;
+                    popped++;
+                    size_t colon = s.find(':');
+                    int p = std::atoi(s.c_str()), i = std::atoi(s.c_str() + colon + 1);
+                    if (colon == std::string::npos || p < 0 || p >= producers || i < 0 || i >= items) {
+                        fail("a malformed element", producers, consumers, Length);
+                        continue;
+                    }
+                    if (i <= last[p]) fail("the elements of a producer out of order", producers, consumers, Length);
+                    last[p] = i;
+                    got[c].push_back((long long) p * items + i);
+                }
+            });
+        for (int i = 0; i < (int) threads.size(); i++) threads[i].join();
+
+        std::vector<char> seen((size_t) producers * items, 0);
+        for (int c = 0; c < consumers; c++)
+            for (int i = 0; i < (int) got[c].size(); i++) {
+                if (seen[got[c][i]]) fail("an element popped twice", producers, consumers, Length);
+                seen[got[c][i]] = 1;
+            }
+        for (size_t i = 0; i < seen.size(); i++)
+            if (!seen[i]) {
+                fail("an element lost", producers, consumers, Length);
+                break;
+            }
+        std::string s;
+        if (q.try_pop_front(s) || !q.empty()) fail("the queue is not empty at the end", producers, consumers, Length);
+        //the destructor frees the elements still in the queue
+        for (int i = 0; i < 3 * Length + 1; i++) q.push_back("left");
+    }
+}
+
+int main() {
+    run<1>(4, 4, 20000);
+    run<1>(1, 6, 20000);
+    run<3>(3, 5, 20000);
+    run<3>(6, 1, 20000);
+    run<64>(6, 2, 50000);
+    run<64>(4, 4, 50000);
+    if (failures.load() != 0) {
+        std::printf("%d failures\n", failures.load());
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
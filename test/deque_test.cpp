@@ -0,0 +1,376 @@
+//randomized differential test of deque: the same random operations are run on a deque and on
+//a std::deque, and both must hold the same elements after every step. the small block lengths
+//make the nodes split, merge and lend all the time. every kind of deque is checked: inline and
+//boxed storage, copy_on_write_policy and statistics_policy, block lengths 2 to 16 and the default.
+//build it with -fsanitize=address (cmake -DSJTU_SANITIZE=address) to check the node handling.
+//build: g++ -std=c++14 -O1 -g -fsanitize=address,undefined -pthread -I.. deque_test.cpp
+
+#include "deque.hpp"
+#include "parallel_algorithm.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void fail(const char *what, const char *kind, int length, unsigned seed, int step) {
+        if (failures++ < 10)
+            std::printf("%s (%s, block length %d, seed %u, step %d)\n", what, kind, length, seed, step);
+    }
+
+    int makeValue(int v, int *) { return v; }
+
+    std::string makeValue(int v, std::string *) { return std::to_string(v); }
+
+    //the key of the stable sorts, many elements have the same key
+    int key(int v) { return v % 7; }
+
+    int key(const std::string &s) { return (int) s.size(); }
+
+    struct byKey {
+        template<class T>
+        bool operator()(const T &a, const T &b) const { return key(a) < key(b); }
+    };
+
+    template<class D>
+    class tester {
+    public:
+        typedef typename D::value_type T;
+
+        tester(const char *k, unsigned s) : kind(k), seed(s), step(0), rnd(s) {}
+
+        void run(int steps) {
+            for (step = 0; step < steps && failures < 10; step++) {
+                one();
+                check(d, s, "the deque differs from std::deque");
+                check(e, se, "the second deque differs from std::deque");
+            }
+            checkStats(std::integral_constant<bool, D::statistics>());
+        }
+
+    private:
+        const char *kind;
+        unsigned seed;
+        int step;
+        std::mt19937 rnd;
+        //d is the deque under test, e the one it splices with
+        D d, e;
+        std::deque<T> s, se;
+
+        int random(int n) { return n <= 0 ? 0 : (int) (rnd() % (unsigned) n); }
+
+        T value() { return makeValue(random(1000), (T *) NULL); }
+
+        //std::deque::insert() of no elements may move an element onto itself, which empties a string
+        template<class It>
+        static void modelInsert(std::deque<T> &y, int i, It first, It last) {
+            if (first != last) y.insert(y.begin() + i, first, last);
+        }
+
+        void failure(const char *what) { fail(what, kind, D::nodeLength, seed, step); }
+
+        void check(D &x, const std::deque<T> &y, const char *what) {
+            if (x.size() != y.size() || x.empty() != y.empty()) {
+                failure(what);
+                return;
+            }
+            if (!std::equal(y.begin(), y.end(), x.begin())) failure(what);
+            const D &c = x;
+            if (!std::equal(y.rbegin(), y.rend(), std::reverse_iterator<typename D::const_iterator>(c.cend())))
+                failure(what);
+            if (!y.empty()) {
+                int i = random((int) y.size());
+                if (c[i] != y[i] || x.at(i) != y[i] || *(x.begin() + i) != y[i]
+                    || (x.begin() + i) - x.begin() != i || x.end() - (x.begin() + i) != (int) y.size() - i
+                    || x.front() != y.front() || x.back() != y.back())
+                    failure(what);
+            }
+        }
+
+        void one() {
+            int n = (int) s.size();
+            //keep the deques small, so that they are compared after every step
+            if (n > 600) {
+                int i = random(n / 2);
+                d.erase(d.begin() + i, d.begin() + i + n / 2);
+                s.erase(s.begin() + i, s.begin() + i + n / 2);
+                return;
+            }
+            if (se.size() > 400) {
+                e.clear();
+                se.clear();
+            }
+            int op = random(26);
+            if (op <= 3) {
+                T v = value();
+                d.push_back(v);
+                s.push_back(v);
+            } else if (op <= 6) {
+                T v = value();
+                d.push_front(v);
+                s.push_front(v);
+            } else if (op == 7) {
+                if (n == 0) {
+                    expectEmptyThrows();
+                    return;
+                }
+                d.pop_back();
+                s.pop_back();
+            } else if (op == 8) {
+                if (n == 0) return;
+                d.pop_front();
+                s.pop_front();
+            } else if (op <= 10) {
+                int i = random(n + 1);
+                T v = value();
+                typename D::iterator it = d.insert(d.begin() + i, v);
+                s.insert(s.begin() + i, v);
+                if (it - d.begin() != i) failure("insert() returns a wrong iterator");
+            } else if (op == 11) {
+                if (n == 0) return;
+                int i = random(n);
+                typename D::iterator it = d.erase(d.begin() + i);
+                s.erase(s.begin() + i);
+                if (it - d.begin() != i) failure("erase() returns a wrong iterator");
+            } else if (op == 12) {
+                int i = random(n + 1), k = random(3 * D::nodeLength);
+                T v = value();
+                typename D::iterator it = d.insert(d.begin() + i, (size_t) k, v);
+                if (k > 0) s.insert(s.begin() + i, (size_t) k, v);
+                if (it - d.begin() != i) failure("insert(pos, count, value) returns a wrong iterator");
+            } else if (op == 13) {
+                int i = random(n + 1);
+                std::vector<T> v(random(3 * D::nodeLength));
+                for (int j = 0; j < (int) v.size(); j++) v[j] = value();
+                typename D::iterator it = d.insert(d.begin() + i, v.begin(), v.end());
+                modelInsert(s, i, v.begin(), v.end());
+                if (it - d.begin() != i) failure("insert(pos, first, last) returns a wrong iterator");
+            } else if (op == 14) {
+                int i = random(n + 1), j = i + random(n - i + 1);
+                typename D::iterator it = d.erase(d.begin() + i, d.begin() + j);
+                s.erase(s.begin() + i, s.begin() + j);
+                if (it - d.begin() != i) failure("erase(first, last) returns a wrong iterator");
+            } else if (op == 15) {
+                //split_off() and a splice of the cut off part into e, as in log sharding
+                int i = random(n + 1), j = random((int) se.size() + 1);
+                D t = d.split_off(d.begin() + i);
+                e.splice(e.begin() + j, t);
+                if (!t.empty()) failure("splice() leaves elements in the source");
+                modelInsert(se, j, s.begin() + i, s.end());
+                s.erase(s.begin() + i, s.end());
+            } else if (op == 16) {
+                int m = (int) se.size();
+                int a = random(m + 1), b = a + random(m - a + 1), i = random(n + 1);
+                d.splice(d.begin() + i, e, e.begin() + a, e.begin() + b);
+                modelInsert(s, i, se.begin() + a, se.begin() + b);
+                se.erase(se.begin() + a, se.begin() + b);
+            } else if (op == 17) {
+                if (random(2) == 0) {
+                    d.append(std::move(e));
+                    modelInsert(s, (int) s.size(), se.begin(), se.end());
+                    se.clear();
+                } else {
+                    int i = random(n + 1);
+                    d.splice(d.begin() + i, e);
+                    modelInsert(s, i, se.begin(), se.end());
+                    se.clear();
+                }
+            } else if (op == 18) {
+                if (random(4) == 0) d.shrink_to_fit();
+                else d.compact(random(2 * D::nodeLength));
+            } else if (op == 19) {
+                int how = random(4);
+                if (how == 0) {
+                    d.sort();
+                    std::sort(s.begin(), s.end());
+                } else if (how == 1) {
+                    d.stable_sort(byKey());
+                    std::stable_sort(s.begin(), s.end(), byKey());
+                } else if (how == 2) {
+                    sjtu::parallel_sort(d, 3);
+                    std::sort(s.begin(), s.end());
+                } else {
+                    d.sort(byKey());
+                    std::stable_sort(s.begin(), s.end(), byKey());
+                    //not stable, only the keys are compared
+                    if (d.size() != s.size()) failure("sort() changes the size");
+                    for (int k = 0; k < (int) s.size(); k++)
+                        if (key(d[k]) != key(s[k])) {
+                            failure("sort() is out of order");
+                            break;
+                        }
+                    s.clear();
+                    for (int k = 0; k < (int) d.size(); k++) s.push_back(d[k]);
+                }
+            } else if (op == 20) {
+                copies();
+            } else if (op == 21) {
+                moves();
+            } else if (op == 22) {
+                saveLoad(std::integral_constant<bool, std::is_trivially_copyable<T>::value>());
+            } else if (op == 23) {
+                int k = random(2 * D::nodeLength);
+                T v = value();
+                if (random(2) == 0) {
+                    d.assign((size_t) k, v);
+                    s.assign((size_t) k, v);
+                } else {
+                    std::vector<T> w(k);
+                    for (int j = 0; j < k; j++) w[j] = value();
+                    d.assign(w.begin(), w.end());
+                    s.assign(w.begin(), w.end());
+                }
+            } else if (op == 24) {
+                d.swap(e);
+                s.swap(se);
+            } else {
+                if (random(8) == 0) {
+                    d.clear();
+                    s.clear();
+                }
+                try {
+                    d.at(s.size());
+                    failure("at() does not throw past the end");
+                } catch (sjtu::index_out_of_bound &) {
+                }
+            }
+        }
+
+        void expectEmptyThrows() {
+            try {
+                d.pop_back();
+                failure("pop_back() does not throw on an empty deque");
+            } catch (sjtu::container_is_empty &) {
+            }
+        }
+
+        //a copy is equal and independent of the original (with copy-on-write the blocks are shared)
+        void copies() {
+            D c(d);
+            check(c, s, "a copy differs");
+            std::deque<T> sc(s);
+            T v = value();
+            c.push_front(v);
+            sc.push_front(v);
+            if (!s.empty()) {
+                int i = random((int) s.size());
+                d.erase(d.begin() + i);
+                s.erase(s.begin() + i);
+            }
+            if (!sc.empty()) {
+                c[sc.size() - 1] = v;
+                sc.back() = v;
+            }
+            check(c, sc, "a copy changes with the original");
+            check(d, s, "the original changes with a copy");
+            D a;
+            a.push_back(value());
+            a = c;
+            check(a, sc, "an assigned copy differs");
+            a = a;
+            check(a, sc, "a copy assigned to itself differs");
+        }
+
+        //a moved-from deque is empty and can be used again
+        void moves() {
+            D m(std::move(d));
+            check(m, s, "a moved deque differs");
+            if (d.size() != 0 || d.begin() != d.end()) failure("a moved-from deque is not empty");
+            T v = value();
+            d.push_back(v);
+            d.clear();
+            D a;
+            a = std::move(m);
+            check(a, s, "a move assigned deque differs");
+            d = std::move(a);
+        }
+
+        void saveLoad(std::true_type) {
+            std::stringstream ss;
+            d.save(ss);
+            D l;
+            for (int k = random(D::nodeLength); k > 0; k--) l.push_back(value());
+            l.load(ss);
+            check(l, s, "a loaded deque differs");
+            std::stringstream bad("not a deque");
+            try {
+                l.load(bad);
+                failure("load() does not throw on a bad stream");
+            } catch (sjtu::runtime_error &) {
+            }
+            check(l, s, "a failed load() changes the deque");
+        }
+
+        void saveLoad(std::false_type) {}
+
+        void checkStats(std::true_type) {
+            sjtu::deque_stats st = d.stats();
+            long long nodes = 0;
+            for (int i = 0; i < sjtu::deque_stats::buckets; i++) nodes += st.fill_histogram[i];
+            if (nodes != st.nodes) failure("the fill histogram does not add up to the nodes");
+            if (st.splits < 0 || st.merges < 0 || st.searches <= 0) failure("the counters are wrong");
+        }
+
+        void checkStats(std::false_type) {
+            sjtu::deque_stats st = d.stats();
+            if (st.searches != 0 || st.splits != 0) failure("the counters are kept without statistics");
+        }
+    };
+
+    template<class D>
+    void run(const char *kind, int steps) {
+        for (unsigned seed = 1; seed <= 3; seed++) tester<D>(kind, seed).run(steps);
+    }
+
+    template<int Length>
+    void runLengths() {
+        run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>, Length> >("inline", 3000);
+        runLengths<Length - 1>();
+    }
+
+    template<>
+    void runLengths<1>() {}
+}
+
+int main() {
+    //every block length from 2 to 16 and the default
+    runLengths<16>();
+    run<sjtu::deque<int> >("inline", 3000);
+    run<sjtu::deque<std::string, sjtu::inline_storage, std::allocator<std::string>, 3> >("inline string", 3000);
+    run<sjtu::deque<std::string> >("inline string", 3000);
+
+    run<sjtu::deque<int, sjtu::boxed_storage, std::allocator<int>, 2> >("boxed", 3000);
+    run<sjtu::deque<int, sjtu::boxed_storage, std::allocator<int>, 5> >("boxed", 3000);
+    run<sjtu::deque<std::string, sjtu::boxed_storage, std::allocator<std::string>, 4> >("boxed string", 3000);
+    run<sjtu::deque<int, sjtu::boxed_storage> >("boxed", 3000);
+
+    run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>, 2, sjtu::copy_on_write_policy> >(
+            "copy-on-write", 3000);
+    run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>, 7, sjtu::copy_on_write_policy> >(
+            "copy-on-write", 3000);
+    run<sjtu::deque<std::string, sjtu::boxed_storage, std::allocator<std::string>, 3,
+            sjtu::copy_on_write_policy> >("boxed copy-on-write string", 3000);
+    run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>,
+            sjtu::default_block_length<int, sjtu::inline_storage>::value, sjtu::copy_on_write_policy> >(
+            "copy-on-write", 3000);
+
+    run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>, 3, sjtu::statistics_policy> >(
+            "statistics", 3000);
+    run<sjtu::deque<int, sjtu::inline_storage, std::allocator<int>,
+            sjtu::default_block_length<int, sjtu::inline_storage>::value, sjtu::statistics_policy> >(
+            "statistics", 3000);
+    if (failures != 0) {
+        std::printf("%d failures\n", failures);
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+#ifndef SJTU_WORK_STEALING_DEQUE_HPP
+#define SJTU_WORK_STEALING_DEQUE_HPP
+
+#include "deque.hpp"
+
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+namespace sjtu {
+
+    //a Chase-Lev work-stealing deque made of node blocks. the owner thread calls push_back
+    //and pop_back, which only use plain loads and stores of the atomics (and one fence in
+    //pop_back), while any other thread can steal from the front.
+    //the element at the rank i is in the slot i % nodeLength of the block i / nodeLength,
+    //which is found in a ring of block pointers. when the ring is full it is doubled and the
+    //block pointers are copied, the elements are never moved. the old rings are kept until the
+    //deque is destroyed, as some thieves may still read them.
+    //T must be trivially copyable, a thief may read an element that is written at the same time
+    //(the read is thrown away then), so the slots are atomic.
+    template<class T, int BlockLength = default_block_length<T, inline_storage>::value>
+    class work_stealing_deque {
+    public:
+        static const int nodeLength = BlockLength;
+        static_assert(BlockLength >= 1, "a node must hold at least one element");
+        static_assert(std::is_trivially_copyable<T>::value, "the elements must be trivially copyable");
+
+    private:
+        struct node {
+            std::atomic<T> data[nodeLength];
+        };
+
+        //a ring of mask + 1 (a power of 2) blocks
+        struct ring {
+            long long mask;
+            node **blocks;
+
+            std::atomic<T> &at(long long i) const {
+                return blocks[(i / nodeLength) & mask]->data[i % nodeLength];
+            }
+        };
+
+        std::atomic<long long> top;   //the rank of the first element, only increased by the CAS of pop_back and steal
+        char pad1[64];
+        std::atomic<long long> bottom;    //the rank after the last element, only changed by the owner
+        char pad2[64];
+        std::atomic<ring *> current;
+        std::vector<ring *> rings;  //every ring ever used, the last one is current
+
+        ring *newRing(long long blocks) {
+            ring *r = new ring;
+            r->mask = blocks - 1;
+            r->blocks = new node *[blocks];
+            rings.push_back(r);
+            return r;
+        }
+
+        //double the ring, the blocks of the elements in [t, b) keep their places for their ranks.
+        //the ring grows before the block of b comes back to the place of the block of t, so a
+        //block never holds the elements of two places.
+        ring *grow(ring *old, long long t, long long b) {
+            long long n = old->mask + 1;
+            ring *r = newRing(2 * n);
+            std::vector<char> used(2 * n, 0), placed(n, 0);
+            for (long long j = t / nodeLength; j <= (b - 1) / nodeLength; j++) {
+                r->blocks[j & r->mask] = old->blocks[j & old->mask];
+                used[j & r->mask] = 1;
+                placed[j & old->mask] = 1;
+            }
+            //the other blocks of the old ring are reused, and new ones fill the rest
+            long long k = 0;
+            for (long long i = 0; i < 2 * n; i++) {
+                if (used[i]) continue;
+                while (k < n && placed[k]) k++;
+                if (k < n) {
+                    r->blocks[i] = old->blocks[k];
+                    placed[k] = 1;
+                } else r->blocks[i] = new node;
+            }
+            current.store(r, std::memory_order_release);
+            return r;
+        }
+
+    public:
+        work_stealing_deque() : top(0), bottom(0) {
+            ring *r = newRing(2);
+            r->blocks[0] = new node;
+            r->blocks[1] = new node;
+            current.store(r, std::memory_order_relaxed);
+        }
+
+        work_stealing_deque(const work_stealing_deque &) = delete;
+
+        work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+        //no thread may be using the deque any more
+        ~work_stealing_deque() {
+            ring *r = current.load();
+            for (long long i = 0; i <= r->mask; i++) delete r->blocks[i];
+            for (int i = 0; i < (int) rings.size(); i++) {
+                delete[] rings[i]->blocks;
+                delete rings[i];
+            }
+        }
+
+        //owner only: adds an element to the end
+        void push_back(const T &value) {
+            long long b = bottom.load(std::memory_order_relaxed);
+            long long t = top.load(std::memory_order_acquire);
+            ring *r = current.load(std::memory_order_relaxed);
+            if (b / nodeLength - t / nodeLength > r->mask) r = grow(r, t, b);
+            r->at(b).store(value, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        //owner only: removes the last element and copies it to value.
+        //returns false if the deque is empty.
+        bool pop_back(T &value) {
+            long long b = bottom.load(std::memory_order_relaxed) - 1;
+            ring *r = current.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            value = r->at(b).load(std::memory_order_relaxed);
+            if (t == b) {
+                //the last element, race with the thieves for it
+                bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        //any thread: removes the first element and copies it to value.
+        //returns false if the deque is empty or another thread took the element first.
+        bool steal(T &value) {
+            long long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long b = bottom.load(std::memory_order_acquire);
+            if (t >= b) return false;
+            ring *r = current.load(std::memory_order_acquire);
+            value = r->at(t).load(std::memory_order_relaxed);
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        }
+
+        //the number of elements, only a hint while other threads are using the deque
+        size_t size() const {
+            long long b = bottom.load(std::memory_order_relaxed);
+            long long t = top.load(std::memory_order_relaxed);
+            return b > t ? b - t : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+    };
+}
+
+#endif